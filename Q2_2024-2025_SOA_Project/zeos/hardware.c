@@ -114,3 +114,57 @@ __asm__ __volatile__(
   : : );
 }
 
+/*
+ * PIT ports: 0x40 = channel 0 data, 0x43 = mode/command
+ */
+static void pit_out(Word port, Byte value)
+{
+__asm__ __volatile__(
+  "outb %0, %1"
+  : /*no output*/
+  : "a" (value), "Nd" (port) );
+}
+
+static Byte pit_in(Word port)
+{
+  Byte value;
+__asm__ __volatile__(
+  "inb %1, %0"
+  : "=a" (value)
+  : "Nd" (port) );
+  return value;
+}
+
+static void pit_program(Byte mode, unsigned int count)
+{
+  pit_out(0x43, mode);          /* Channel 0, lobyte/hibyte access */
+  pit_out(0x40, count & 0xff);
+  pit_out(0x40, (count >> 8) & 0xff);
+}
+
+void set_timer_periodic(unsigned int count)
+{
+  pit_program(0x34, count);     /* Mode 2: rate generator */
+}
+
+void set_timer_oneshot(unsigned int count)
+{
+  pit_program(0x30, count);     /* Mode 0: interrupt on terminal count */
+}
+
+unsigned int get_timer_count(void)
+{
+  unsigned int lo, hi;
+
+  pit_out(0x43, 0x00);          /* Latch channel 0 */
+  lo = pit_in(0x40);
+  hi = pit_in(0x40);
+  return (hi << 8) | lo;
+}
+
+int timer_fired(void)
+{
+  pit_out(0x43, 0xe2);          /* Read-back status of channel 0 */
+  return (pit_in(0x40) & 0x80) != 0;  /* OUT pin */
+}
+
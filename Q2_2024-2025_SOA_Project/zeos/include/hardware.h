@@ -38,4 +38,20 @@ void return_gate(Word ds, Word ss, DWord esp, Word cs, DWord eip);
 
 void enable_int(void);
 void delay(void);
+
+/*
+ * PIT (8254) channel 0, connected to IRQ0. 'count' is in PIT_FREQ cycles
+ * (1..65535).
+ *
+ *   set_timer_periodic: Mode 2, an interrupt every 'count' cycles
+ *   set_timer_oneshot:  Mode 0, a single interrupt after 'count' cycles
+ *   get_timer_count:    Cycles left in the current count
+ *   timer_fired:        1 if the one-shot count has already expired
+ */
+#define PIT_FREQ 1193182
+
+void set_timer_periodic(unsigned int count);
+void set_timer_oneshot(unsigned int count);
+unsigned int get_timer_count(void);
+int timer_fired(void);
 #endif  /* __HARDWARE_H__ */
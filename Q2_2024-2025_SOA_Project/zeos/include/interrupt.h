@@ -6,9 +6,17 @@
 #define __INTERRUPT_H__
 
 #include <types.h>
+#include <hardware.h>
 
 #define IDT_ENTRIES 256
 
+/* Clock interrupts per second, programmed in the PIT at boot */
+#define HZ 100
+#define LATCH ((PIT_FREQ + HZ/2) / HZ)
+
+/* Longest one-shot the 16-bit PIT counter can hold, in ticks */
+#define NOHZ_MAX_TICKS (65535 / LATCH)
+
 extern Gate idt[IDT_ENTRIES];
 extern Register idtR;
 
@@ -16,5 +24,10 @@ void setInterruptHandler(int vector, void (*handler)(), int maxAccessibleFromPL)
 void setTrapHandler(int vector, void (*handler)(), int maxAccessibleFromPL);
 
 void setIdt();
+void setSysenter();
+
+/* Tickless idle (DYNTICKS): stop the periodic tick while idle */
+void tick_nohz_idle_enter(void);
+void tick_nohz_idle_exit(void);
 
 #endif  /* __INTERRUPT_H__ */
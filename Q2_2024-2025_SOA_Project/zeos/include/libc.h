@@ -26,8 +26,58 @@ void exit();
 
 int yield();
 
+int yield_to(int tid);
+
 int get_stats(int pid, struct stats *st);
 
+int get_sched_stats(struct sched_stats *st);
+
+int get_latency(int pid, struct lat_hist *h);
+
+int get_mem_stats(struct mem_stats *st);
+
+int get_slab_stats(int idx, struct slab_stats *st);
+
+int lat_percentile(struct lat_hist *h, int pct);
+
 int pthread_create(void *(*func)(void*), void *param, int stack_size);
 
+/* Shared memory: 'key' 0 always makes a new segment. shmat picks the
+ * address if 'addr' is NULL */
+int shmget(int key, int size);
+
+void *shmat(int id, void *addr);
+
+int shmdt(void *addr);
+
+int shmrm(int id);
+
+/* Moves the end of the heap, returns the previous one */
+void *sbrk(int increment);
+
+/* Heap allocator (malloc.c), safe to use from any thread */
+void *malloc(int size);
+
+void free(void *p);
+
+int futex_wait(int *addr, int val);
+
+int futex_wake(int *addr, int n);
+
+/*
+ * Semaphore in user memory: wait and post only enter the kernel when a
+ * thread has to sleep or be woken up. It must be a global variable (the
+ * kernel only sleeps on addresses of the user data).
+ */
+typedef struct {
+  volatile int value;   /* Available units */
+  volatile int waiters; /* Threads sleeping or about to sleep on 'value' */
+} fsem_t;
+
+void fsem_init(fsem_t *s, int value);
+
+void fsem_wait(fsem_t *s);
+
+void fsem_post(fsem_t *s);
+
 #endif  /* __LIBC_H__ */
@@ -8,19 +8,57 @@
 #include <types.h>
 #include <mm_address.h>
 #include <sched.h>
+#include <stats.h>
 
  
 #define FREE_FRAME 0
 #define USED_FRAME 1
-/* Bytemap to mark the free physical pages */
-extern Byte phys_mem[TOTAL_PAGES];
 
+/* Largest block of the frame allocator: 2^MAX_ORDER frames */
+#define MAX_ORDER (BUDDY_ORDERS-1)
 
-extern page_table_entry dir_pages[NR_TASKS][TOTAL_PAGES];
+/* Page table entry 'avail' bit: shared copy-on-write, read-only until
+ * written */
+#define PTE_COW 0x1
+
+#define CR0_WP 0x00010000
+#define CR4_PSE 0x00000010
+#define CR4_PGE 0x00000080
+
+/* Unmapped pages below each thread stack: an overflow faults instead of
+ * writing to the memory below */
+#define STACK_GUARD_PAGES 1
+
+/* Pages invalidated one by one at most: with more, reloading CR3 costs less
+ * than the invlpgs */
+#define TLB_FLUSH_THRESHOLD 32
+
+/* Pages of the address space 'dir' whose entries changed, dropped from the
+ * TLBs at once by tlb_batch_flush */
+struct tlb_batch {
+  page_table_entry *dir;
+  int nr;                                 /* Pages queued */
+  unsigned int pages[TLB_FLUSH_THRESHOLD];
+};
+
+
+extern page_table_entry dir_pages[TOTAL_PAGES];
+extern page_table_entry pagusr_table[TOTAL_PAGES];
 
 int init_frames( void );
 int alloc_frame( void );
 void free_frame( unsigned int frame );
+int alloc_frames( int order );
+void free_frames( unsigned int frame, int order );
+int alloc_frame_run( int nr );
+int share_frame( unsigned int frame );
+int frame_refs( unsigned int frame );
+void set_frame_private( unsigned int frame, void *p );
+void *frame_private( unsigned int frame );
+void get_mem_stats( struct mem_stats *s );
+page_table_entry *new_DIR( void );
+int share_DIR( page_table_entry *dir );
+int put_DIR( page_table_entry *dir );
 void set_user_pages( struct task_struct *task );
 
 
@@ -39,4 +77,13 @@ void set_ss_pag(page_table_entry *PT, unsigned page,unsigned frame);
 void del_ss_pag(page_table_entry *PT, unsigned page);
 unsigned int get_frame(page_table_entry *PT, unsigned int page);
 
+void set_wp_flag();
+int share_cow_page(page_table_entry *src, page_table_entry *dst, unsigned page);
+int cow_fault(unsigned long addr, int user);
+int stack_fault(unsigned long addr);
+
+void tlb_batch_init(struct tlb_batch *b, page_table_entry *dir);
+void tlb_batch_add(struct tlb_batch *b, unsigned int page);
+void tlb_batch_flush(struct tlb_batch *b);
+
 #endif  /* __MM_H__ */
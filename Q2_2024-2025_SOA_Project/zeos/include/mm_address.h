@@ -2,6 +2,7 @@
 #define MM_ADDRESS_H
 
 #define ENTRY_DIR_PAGES       0
+#define ENTRY_DIR_KMEM        1
 
 #define TOTAL_PAGES 1024
 #define NUM_PAG_KERNEL 256
@@ -11,6 +12,9 @@
 #define PAG_LOG_INIT_DATA (PAG_LOG_INIT_CODE+NUM_PAG_CODE)
 #define NUM_PAG_DATA 20
 #define PAGE_SIZE 0x1000
+/* Heap of the processes (sys_sbrk), kept apart from the thread stacks */
+#define PAG_LOG_INIT_HEAP (TOTAL_PAGES/2)
+#define NUM_PAG_HEAP 256
 
 /* Memory distribution */
 /***********************/
@@ -23,6 +27,21 @@
 
 #define USER_FIRST_PAGE	(L_USER_START>>12)
 
+/* Kernel window: every frame f is seen by the kernel at KMEM_START + f
+ * pages, in every address space. A single 4 MB global page (see
+ * init_dir_pages), so the kernel reads, copies and zeroes frames without
+ * mapping them */
+#define KMEM_START	(ENTRY_DIR_KMEM<<22)
+#define frame_to_kaddr(f)	((void *)(KMEM_START + ((f)<<12)))
+#define kaddr_to_frame(a)	((((unsigned int)(a)) - KMEM_START)>>12)
+
+/* Kernel address of a kernel object in frame 'f': identity mapped in the
+ * kernel pages, through the window above them */
+#define frame_kaddr(f)	((f) < NUM_PAG_KERNEL ? (void *)((f)<<12) : frame_to_kaddr(f))
+/* Physical address of the kernel address 'a' */
+#define kaddr_phys(a)	(((unsigned int)(a)) >= KMEM_START ? \
+			 ((unsigned int)(a)) - KMEM_START : ((unsigned int)(a)))
+
 #define PH_PAGE(x) (x>>12)
 
 #endif
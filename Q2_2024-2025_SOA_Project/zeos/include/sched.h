@@ -10,16 +10,30 @@
 #include <mm_address.h>
 #include <stats.h>
 #include <p_stats.h>
+#include <timer.h>
+#include <smp.h>
 
-#define NR_TASKS      10
+/* Static task slots, used at boot: the idle task of CPU 0, task1 and the
+ * stack of the boot. The other tasks get a frame each (alloc_task_union) */
+#define NR_BOOT_TASKS 3
+
+/* Live tasks at most (each one takes a frame at least) */
+#define MAX_TASKS     512
+
+/* Buckets of the PID hash */
+#define PID_HASH_BITS 6
+#define PID_HASH_SIZE (1 << PID_HASH_BITS)
 #define KERNEL_STACK_SIZE	1024
 
 #define KERNEL_ESP(t)       	(DWord) &(t)->stack[KERNEL_STACK_SIZE]
 
 enum state_t { ST_RUN, ST_READY, ST_BLOCKED };
 
-#define DEFAULT_QUANTUM 10
+struct sched_class;
+
+#define DEFAULT_QUANTUM 10  /* Until the scheduler tunes it */
 #define DEFAULT_PRIORITY 20
+#define MAX_PRIORITY 100
 #define DEFAULT_STACK_SIZE 1024
 
 #define MAX_SEMAPHORES 20
@@ -32,29 +46,32 @@ enum state_t { ST_RUN, ST_READY, ST_BLOCKED };
  * 
  * This structure implements a counting semaphore that can be used for
  * thread synchronization and mutual exclusion. It supports:
- * - Multiple threads waiting on the same semaphore
+ * - Multiple threads waiting on the same semaphore, woken up by priority
  * - Counting semaphore functionality
  * - Thread ownership tracking
+ * - Priority inheritance when used as a mutex (initial count 1): the holder
+ *   runs at the priority of its highest waiter until it posts
  */
 struct sem_t {
     int count;                  /* Current semaphore value */
     int TID;                    /* Thread ID of the owner */
-    struct list_head blocked;   /* Queue of blocked threads */
+    struct list_head blocked;   /* Queue of blocked threads, highest priority first */
+    int mutex;                  /* Initialized with count 1 */
+    struct task_struct *holder; /* Thread that holds the mutex, or NULL */
     // int sem_id;              /* Semaphore ID */ 
 };
 
 /**
  * @brief Semaphore array structure
  * 
- * This structure holds an array of semaphores and their owner information
+ * This structure holds an array of semaphores and their owner information.
+ * One is allocated for each process, from a slab cache
  */
 struct sem_array {
     int owner;                              /* Owner thread ID */
     struct sem_t sem[MAX_SEMAPHORES]; /* Array of semaphores */
 };
 
-extern struct sem_array semaphores[NR_TASKS];
-
 // ! ----------------- TASK STRUCT -----------------
 
 struct task_struct {
@@ -65,14 +82,44 @@ struct task_struct {
   enum state_t state;		/* State of the process */
   int total_quantum;		/* Total quantum of the process */
   struct stats p_stats;		/* Process stats */
+  unsigned long long ready_tsc;	/* TSC when it last became READY, 0 if not */
+  struct lat_hist lat;		/* Its READY->RUN latencies */
   
   /*  ---------------- THREAD SUPPORT ---------------- */  
   void *screen_page;     /* Screen page for video output */
-  int pause_time;        /* Time to pause in milliseconds */
+  struct timer_list pause_timer; /* Wakes the task up from sys_pause */
   int priority;          /* Priority of the process/thread */
+  struct sched_class *sched_class; /* Scheduling policy owning the task */
+
+  /* MLFQ class state (sched_mlfq.c) */
+  int mlfq_level;                  /* Queue level, 0 is the highest */
+  int mlfq_used;                   /* Ticks run at this level */
+  int mlfq_epoch;                  /* Boost epoch seen by the task */
+  unsigned long mlfq_cpu_mark;     /* user+system ticks when it reached the level */
+  unsigned long mlfq_blocked_mark; /* blocked ticks when it reached the level */
+
+  /* Fair class state (sched_fair.c) */
+  unsigned long long vruntime;     /* CPU time scaled by DEFAULT_PRIORITY/priority */
+  unsigned long fair_exec_mark;    /* user+system ticks already charged to vruntime */
+  int fair_heap_idx;               /* Position in the heap of READY tasks */
+
+  /* EDF class state (sched_edf.c). Times in ticks (zeos_ticks) */
+  int edf_period;                  /* Time between releases */
+  int edf_budget;                  /* CPU time granted every period */
+  int edf_rel_deadline;            /* Deadline relative to the release */
+  unsigned long edf_release;       /* Release of the current job */
+  unsigned long edf_deadline;      /* Absolute deadline of the current job */
+  int edf_runtime;                 /* Budget left to the current job */
+  struct timer_list edf_timer;     /* Next release while blocked by the class */
+  struct sched_class *edf_prev_class; /* Class to go back to */
+
+  /* SMP */
+  int cpu;              /* CPU running the task, or whose queues hold it */
+  int exiting;          /* Killed while running on another CPU */
   
   int TID;              /* Thread ID */
   int thread_count;      /* Number of threads in the proces */
+  struct list_head pid_link;         /* In the PID hash while alive */
 
   struct task_struct *master_thread; /* Pointer to the main thread (master) of the process */
   struct list_head threads;          /* List of threads created by this process */
@@ -81,10 +128,19 @@ struct task_struct {
   /* ---------------- MEMORY MANAGEMENT ---------------- */
   int *user_stack_ptr; /* Pointer to the user stack */
   int user_stack_frames; /* Number of pages allocated for user stack */
+  unsigned int heap_brk; /* End of the heap (sys_sbrk), in the master */
+  struct list_head vmas; /* Memory areas of the process (struct vma),
+                            by address, in the master */
 
   /* ---------------- SYNCHRONIZATION ---------------- */
   struct sem_array *semaphores; /* Pointer to semaphore array */
   int next_sem_id; /* Counter for semaphore ids */  
+  int pi_priority;              /* Inherited from mutex waiters, 0 if none */
+  struct sem_t *pi_blocked_on;  /* Semaphore the thread is waiting for */
+  unsigned long pi_wait_start;  /* get_ticks() when it began to wait for a
+                                   lower priority holder, 0 if it did not */
+  int *futex_addr;              /* User address slept on in sys_futex_wait */
+  page_table_entry *futex_dir;  /* Address space of 'futex_addr' */
 };
 
 // ! ----------------- TASK UNION -----------------
@@ -94,9 +150,15 @@ union task_union {
   unsigned long stack[KERNEL_STACK_SIZE]; /* system stack, for process */
 };
 
-extern union task_union protected_tasks[NR_TASKS+2];
+extern union task_union protected_tasks[NR_BOOT_TASKS+2];
 extern union task_union *task; /* Vector of tasks */
-extern struct task_struct *idle_task;
+extern struct task_struct *idle_task; /* Idle task of the bootstrap CPU */
+
+#define is_idle_task(t) ((t) == cpus[(t)->cpu].idle)
+
+/* Priority the classes schedule 't' with: its own one or the inherited one */
+#define task_prio(t) \
+  ((t)->pi_priority > (t)->priority ? (t)->pi_priority : (t)->priority)
 
 
 int get_quantum(struct task_struct *t);
@@ -104,9 +166,140 @@ void set_quantum(struct task_struct *t, int new_quantum);
 
 #define INITIAL_ESP       	KERNEL_ESP(&task[1])
 
+/* Dead tasks, freed by reap_tasks() */
 extern struct list_head freequeue;
 extern struct list_head readyqueue;
 
+// ! ----------------- RUN QUEUE -----------------
+
+#define RQ_LEVELS       (MAX_PRIORITY+1)
+#define RQ_BITMAP_WORDS ((RQ_LEVELS+31)/32)
+
+/**
+ * @brief Priority run queue (one per CPU)
+ *
+ * READY tasks are kept in one FIFO list per priority level. Bit 'p' of
+ * 'bitmap' is set while queue[p] is not empty and bit 'w' of 'summary' is
+ * set while bitmap[w] is not zero, so finding the highest priority READY
+ * task takes two 'bsr' instructions whatever the number of tasks.
+ */
+struct runqueue {
+  struct list_head queue[RQ_LEVELS];     /* FIFO of READY tasks per priority */
+  unsigned long bitmap[RQ_BITMAP_WORDS]; /* Non-empty priority levels */
+  unsigned long summary;                 /* Non-zero words of 'bitmap' */
+  int nr_running;                        /* Number of READY tasks */
+  unsigned long nr_ops;                  /* Enqueue/dequeue operations since boot */
+  unsigned long ops_per_sec;             /* Operations during the last second */
+  unsigned long ops_mark;                /* nr_ops at the start of the window */
+  int window_start;                      /* zeos_ticks at the start of the window */
+};
+
+extern struct runqueue runqueues[MAX_CPUS];
+
+void rq_update_rate(void);
+
+// ! ----------------- SCHEDULING CLASSES -----------------
+
+/**
+ * @brief Scheduling policy
+ *
+ * Every task points to the class that owns it while it is READY. The core
+ * scheduler (schedule(), sched_next_rr(), update_process_state_rr()) only
+ * reaches the policy through these hooks:
+ * - pick_next: Removes and returns the next READY task of the class queued
+ *              on 'cpu', or NULL
+ * - enqueue:   Adds a new or preempted task to the queues of t->cpu
+ * - dequeue:   Removes a READY task from the class
+ * - tick:      Accounts one clock tick to the running task 't'. Returns 1 if
+ *              't' must leave the CPU, SCHED_THROTTLE if it must also block
+ *              until the class wakes it up
+ * - wakeup:    Adds a task that was BLOCKED to the queues of t->cpu. Returns
+ *              1 if it should preempt the task running on that CPU
+ * - migrate:   Optional. Called when 't' moves from t->cpu to another CPU
+ *              (stolen, or woken up there), before t->cpu becomes 'cpu'
+ * - leave:     Optional. 't', not READY, stops belonging to the class
+ *              because it exits or moves to another class
+ * - prio_changed: Optional. task_prio() of 't', READY, was 'old_prio'
+ * Classes are asked for a task in registration order, so a class
+ * registered first has precedence over the following ones.
+ */
+struct sched_class {
+  char *name;
+  void (*init)(void);
+  struct task_struct *(*pick_next)(int cpu);
+  void (*enqueue)(struct task_struct *t);
+  void (*dequeue)(struct task_struct *t);
+  int (*tick)(struct task_struct *t);
+  int (*wakeup)(struct task_struct *t);
+  void (*migrate)(struct task_struct *t, int cpu);
+  void (*leave)(struct task_struct *t);
+  void (*prio_changed)(struct task_struct *t, int old_prio);
+
+  int rank;                 /* Registration order, set by register_sched_class() */
+  int nr_running[MAX_CPUS]; /* READY tasks of the class per CPU, kept by the core */
+};
+
+#define MAX_SCHED_CLASSES 4
+
+#define SCHED_THROTTLE 2
+
+/* Class given to the initial task (and inherited by its children) unless
+ * the kernel is built with 'make SCHED=<name>' */
+#ifndef SCHED_DEFAULT
+#define SCHED_DEFAULT "rr"
+#endif
+
+extern struct sched_class *default_sched_class;
+extern int nr_ready; /* READY tasks in all the CPUs */
+
+int register_sched_class(struct sched_class *c);
+struct sched_class *find_sched_class(char *name);
+
+/* Round Robin with static priorities (sched_rr.c) */
+extern struct sched_class rr_sched_class;
+
+/* Multi-level feedback queue (sched_mlfq.c). A task that runs for the
+ * whole slice of its level sinks one level; the slice doubles at every
+ * level. Every MLFQ_BOOST_TICKS all the tasks go back to level 0. */
+#define MLFQ_LEVELS 4
+#define MLFQ_BOOST_TICKS (2*HZ)
+
+struct mlfq_stats {
+  unsigned long demotions;  /* Full slices that made a task sink */
+  unsigned long promotions; /* Wakeups of tasks that mostly block */
+  unsigned long boosts;     /* Periodic boosts to level 0 */
+};
+
+extern struct mlfq_stats mlfq_stats;
+extern struct sched_class mlfq_sched_class;
+
+/* Fair share by virtual runtime (sched_fair.c). CPU share is proportional
+ * to the priority. A task waking up is placed at most FAIR_SLEEPER_BONUS
+ * (get_ticks() units) behind the least advanced one. */
+#define FAIR_SLEEPER_BONUS 5000
+
+extern struct sched_class fair_sched_class;
+
+/* Earliest deadline first (sched_edf.c). Periodic tasks declare a budget
+ * of CPU ticks every period; the READY one with the earliest absolute
+ * deadline runs first. A job that exhausts its budget is throttled until
+ * its next release. The sum of budget/period of all the EDF tasks is kept
+ * under EDF_MAX_BW (in 1/EDF_BW_ONE units of one CPU). */
+#define EDF_BW_ONE 1024
+#define EDF_MAX_BW (EDF_BW_ONE * 9 / 10)
+
+struct edf_stats {
+  unsigned long misses;     /* Jobs not finished by their deadline */
+  unsigned long throttles;  /* Jobs that exhausted their budget */
+  int bandwidth;            /* Admitted bandwidth, in 1/EDF_BW_ONE units */
+};
+
+extern struct edf_stats edf_stats;
+extern struct sched_class edf_sched_class;
+
+int edf_set_params(struct task_struct *t, int period, int budget, int deadline);
+int edf_wait_next_period(struct task_struct *t);
+
 // ! ----------------- INITIALIZATION -----------------
 
 /* Initialize the data of the initial process */
@@ -115,11 +308,22 @@ void init_task1(void);
 /* Initialize the idle process */
 void init_idle(void);
 
+/* Initialize the idle task of an application processor */
+void init_idle_task(struct task_struct *c, int cpu);
+
+/* Body of the idle tasks. Entered with the kernel lock held */
+void cpu_idle(void);
+
 /* Initialize the scheduler */
 void init_sched(void);
 
-/* Initialize the semaphore array */
+/* Initialize the cache of semaphore arrays, one per process (sys.c) */
 void init_sem_array(void);
+struct sem_array *alloc_sem_array(int owner);
+void free_sem_array(struct sem_array *a);
+
+/* Initialize the futex wait queues (sys.c) */
+void init_futex(void);
 
 // ! ----------------- SCHEDULING -----------------
 
@@ -127,10 +331,39 @@ void schedule(void);
 
 struct task_struct * current();
 
+/*
+ * Adaptive quantum: a task gets QUANTUM_LATENCY ticks shared among the
+ * tasks waiting on its CPU, so a thread that wakes up waits at most about
+ * that long, but never a quantum so short that task switches take more than
+ * QUANTUM_OVERHEAD per mille of the CPU time (the Makefile sets both).
+ */
+#ifndef QUANTUM_LATENCY
+#define QUANTUM_LATENCY 20
+#endif
+#ifndef QUANTUM_OVERHEAD
+#define QUANTUM_OVERHEAD 10
+#endif
+
+struct quantum_stats {
+  unsigned long switch_cost;     /* TSC cycles of a task switch, moving average */
+  unsigned long switch_cost_max; /* Slowest one */
+  unsigned long switches_timed;  /* Switches measured */
+  unsigned long tick_cycles;     /* TSC cycles per clock tick, moving average */
+  int min_quantum;               /* Shortest quantum within QUANTUM_OVERHEAD */
+};
+
+extern struct quantum_stats quantum_stats;
+
+int sched_tune_quantum(struct task_struct *t);
+void sample_tick_cycles(int periodic);
+
 void task_switch(union task_union*t);
 void switch_stack(int * save_sp, int new_sp);
 
 void sched_next_rr(void);
+int sched_yield_to(struct task_struct *t);
+
+extern unsigned long nr_directed_yields;
 
 void force_task_switch(void);
 
@@ -138,21 +371,54 @@ struct task_struct *list_head_to_task_struct(struct list_head *l);
 
 int allocate_DIR(struct task_struct *t);
 
+union task_union *alloc_task_union(void);
+void free_task_union(union task_union *t);
+void reap_tasks(void);
+
+void hash_task(struct task_struct *t);
+void unhash_task(struct task_struct *t);
+struct task_struct *find_task_by_pid(int pid);
+
 page_table_entry * get_PT (struct task_struct *t) ;
 
 page_table_entry * get_DIR (struct task_struct *t) ;
 
-/* Headers for the scheduling policy */
+/* Headers for the core scheduler */
 
 // ! Insertion into ready queue
-void insert_ready_ordered(struct task_struct *t);
-  
-// ! Round Robin scheduling
+void sched_enqueue(struct task_struct *t);
+int sched_wakeup(struct task_struct *t);
+void sched_dequeue(struct task_struct *t);
+void sched_leave(struct task_struct *t);
+void sched_set_pi_priority(struct task_struct *t, int prio);
+
+/* Priority inheritance of the semaphores (sys.c) */
+struct pi_stats {
+  unsigned long boosts;              /* Holders raised to a waiter's priority */
+  unsigned long inversions;          /* Waits for a lower priority holder */
+  unsigned long inversion_ticks;     /* Total length of those waits (get_ticks()) */
+  unsigned long max_inversion_ticks; /* Longest one */
+};
+
+extern struct pi_stats pi_stats;
+
 void sched_next_rr();
 void update_process_state_rr(struct task_struct *t, struct list_head *dest);
-int needs_sched_rr();
-void update_sched_data_rr();
 
 void init_stats(struct stats *s);
 
+/* READY->RUN latencies of all the tasks, see 'struct lat_hist' */
+extern struct lat_hist sched_lat;
+
+void init_lat_hist(struct lat_hist *h);
+
+/* Task switches by kind. CR3 is only reloaded for 'full' ones */
+struct switch_stats {
+  unsigned long full;      /* To another address space */
+  unsigned long same_mm;   /* Between threads sharing dir_pages_baseAddr */
+  unsigned long lazy_idle; /* To idle, which keeps the previous directory */
+};
+
+extern struct switch_stats switch_stats;
+
 #endif  /* __SCHED_H__ */
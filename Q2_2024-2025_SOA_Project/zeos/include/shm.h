@@ -0,0 +1,48 @@
+/*
+ * shm.h - Shared memory segments
+ */
+
+#ifndef __SHM_H__
+#define __SHM_H__
+
+#include <list.h>
+#include <types.h>
+
+/* Key of shmget() that always makes a new segment */
+#define SHM_PRIVATE 0
+
+/* Pages of a segment at most */
+#define SHM_MAX_PAGES 64
+
+/**
+ * @brief Shared memory segment
+ *
+ * Its frames hold a reference for the segment and one more for every page
+ * table entry mapping them, so they outlive the segment while attached.
+ * The segment goes away once removed (shm_remove) and not attached.
+ */
+struct shm_segment {
+  int id;
+  int key;
+  int nr_pages;
+  int nattch;                   /* Processes attached, or times attached */
+  int removed;                  /* No new shmget/shmat finds it */
+  struct list_head list;        /* In the list of segments */
+  int frames[SHM_MAX_PAGES];
+};
+
+struct task_struct;
+struct tlb_batch;
+
+void init_shm(void);
+int shm_get(int key, int size);
+struct shm_segment *shm_find(int id);
+int shm_attach(struct task_struct *master, struct shm_segment *seg,
+               unsigned int page);
+int shm_detach(struct task_struct *master, unsigned int page,
+               struct tlb_batch *tlb);
+int shm_remove(int id);
+int shm_fork(struct task_struct *parent, struct task_struct *child);
+void shm_exit(struct task_struct *master);
+
+#endif /* __SHM_H__ */
@@ -0,0 +1,53 @@
+/*
+ * slab.h - Kernel object caches (slab allocator) and kmalloc
+ */
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <list.h>
+#include <stats.h>
+
+/* Slabs are blocks of up to 2^SLAB_MAX_ORDER frames */
+#define SLAB_MAX_ORDER 2
+
+/* kmalloc sizes: powers of two from KMALLOC_MIN up to KMALLOC_MAX bytes */
+#define KMALLOC_MIN 32
+#define KMALLOC_MAX 2048
+#define KMALLOC_CACHES 7
+
+/**
+ * @brief Cache of kernel objects of one type
+ *
+ * Its objects come from slabs, blocks of frames seen through the kernel
+ * window. 'ctor', if any, builds every object when its slab is made: a
+ * freed object must be given back built, as kmem_cache_alloc() returns it
+ * as is. The slabs with no objects in use but one are given back to the
+ * frame allocator.
+ */
+struct kmem_cache {
+  char name[SLAB_NAME_LEN];
+  unsigned int size;          /* Object size, rounded up to a word */
+  int order;                  /* A slab is 2^order frames */
+  int per_slab;               /* Objects in a slab */
+  void (*ctor)(void *obj);
+  struct list_head full;      /* Slabs without free objects */
+  struct list_head partial;   /* Slabs with free and used objects */
+  struct list_head empty;     /* Slab kept without objects in use */
+  struct list_head list;      /* In the list of caches */
+  struct slab_stats stats;
+};
+
+void init_slab(void);
+
+struct kmem_cache *kmem_cache_create(char *name, unsigned int size,
+                                     void (*ctor)(void *obj));
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+void *kmalloc(unsigned int size);
+void kfree(void *obj);
+
+int get_slab_stats(int idx, struct slab_stats *s);
+
+#endif /* __SLAB_H__ */
@@ -0,0 +1,91 @@
+/*
+ * smp.h - Symmetric multiprocessing: CPUs, local APIC and per-CPU data
+ */
+
+#ifndef __SMP_H__
+#define __SMP_H__
+
+#define MAX_CPUS 4
+
+/* Physical address where the APs start in real mode (below 1 MB, page
+ * aligned, unused once the bootsect has moved itself to 0x90000) */
+#define AP_TRAMPOLINE 0x8000
+
+#ifndef __ASSEMBLER__
+
+#include <types.h>
+#include <spinlock.h>
+
+/* Local APIC, mapped at the same address in every page directory */
+#define LAPIC_BASE       0xFEE00000
+#define LAPIC_ID         0x020
+#define LAPIC_EOI        0x0B0
+#define LAPIC_SVR        0x0F0
+#define LAPIC_ICR_LOW    0x300
+#define LAPIC_ICR_HIGH   0x310
+#define LAPIC_LVT_TIMER  0x320
+#define LAPIC_LVT_LINT0  0x350
+#define LAPIC_LVT_LINT1  0x360
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR  0x390
+#define LAPIC_TIMER_DIV  0x3E0
+
+/* Interrupt vectors of the local APIC */
+#define LAPIC_TIMER_VECTOR  0x40
+#define RESCHEDULE_VECTOR   0x41
+#define SPURIOUS_VECTOR     0xFF
+
+struct task_struct;
+
+/**
+ * @brief Per-CPU data
+ *
+ * Indexed by the CPU number (0 is the bootstrap processor). The scheduling
+ * classes keep their READY tasks per CPU too, see 'struct sched_class'.
+ * Everything but 'in_kernel' is only touched with the kernel lock held.
+ */
+struct cpu {
+  int id;                         /* CPU number */
+  int apic_id;                    /* Local APIC id */
+  int online;                     /* Running the scheduler */
+  TSS *tss;                       /* esp0 of the running task */
+  struct task_struct *idle;       /* Idle task of the CPU */
+  struct task_struct *curr;       /* Running task */
+  page_table_entry *active_dir;   /* Directory loaded in CR3, NULL to force
+                                     a reload at the next task switch */
+  page_table_entry *loaded_dir;   /* Directory loaded in CR3, always */
+  int remaining_quantum;          /* Ticks left to the running task */
+  unsigned long long switch_tsc;  /* TSC when the last task switch began */
+  int nr_ready;                   /* READY tasks in the queues of the CPU */
+  int need_resched;               /* A wakeup wants 'curr' out of the CPU */
+  int tlb_flush;                  /* Flush the TLB at the next kernel entry */
+  volatile int in_kernel;         /* Not running user code */
+  unsigned long nr_stolen;        /* Tasks taken from other CPUs */
+};
+
+extern struct cpu cpus[MAX_CPUS];
+
+/* Page table of the local APIC, in every directory (see init_dir_pages) */
+extern page_table_entry lapic_table[];
+extern int nr_cpus;
+
+/* The CPU running a task is kept in the task, so it follows from the
+ * kernel stack as current() does */
+#define smp_processor_id() (current()->cpu)
+#define this_cpu() (&cpus[smp_processor_id()])
+#define cpu_curr(c) (cpus[c].curr)
+
+void init_boot_cpu(void);
+void smp_init(void);
+void smp_start(void);
+void send_reschedule(int cpu);
+void flush_tlb_mm(page_table_entry *dir);
+void lapic_eoi(void);
+
+/* Kernel lock, called from entry.S */
+void kernel_enter(void);
+void kernel_exit(void);
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* __SMP_H__ */
@@ -0,0 +1,74 @@
+/*
+ * spinlock.h - Busy-waiting locks for SMP
+ */
+
+#ifndef __SPINLOCK_H__
+#define __SPINLOCK_H__
+
+#include <hardware.h>
+
+typedef struct {
+  volatile int locked;
+} spinlock_t;
+
+#define SPIN_LOCK_UNLOCKED { 0 }
+
+static inline void spin_lock_init(spinlock_t *l)
+{
+  l->locked = 0;
+}
+
+static inline int spin_trylock(spinlock_t *l)
+{
+  return __sync_lock_test_and_set(&l->locked, 1) == 0;
+}
+
+static inline void spin_lock(spinlock_t *l)
+{
+  while (!spin_trylock(l))
+    while (l->locked)
+      __asm__ __volatile__("pause": : :"memory");
+}
+
+static inline void spin_unlock(spinlock_t *l)
+{
+  __sync_lock_release(&l->locked);
+}
+
+/* Also disable the interrupts of the local CPU while the lock is held */
+static inline DWord spin_lock_irqsave(spinlock_t *l)
+{
+  DWord flags = get_eflags();
+
+  __asm__ __volatile__("cli": : :"memory");
+  spin_lock(l);
+  return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *l, DWord flags)
+{
+  spin_unlock(l);
+  if (flags & 0x200)
+    __asm__ __volatile__("sti": : :"memory");
+}
+
+/*
+ * Kernel lock. The kernel runs with interrupts disabled, which only
+ * excludes the other code of the same CPU, so every entry to the kernel
+ * (system calls, interrupts, the idle loop) takes this lock and releases
+ * it on the way back to user mode. A task switch hands the lock over to
+ * the task that resumes.
+ */
+extern spinlock_t kernel_lock;
+
+static inline void lock_kernel(void)
+{
+  spin_lock(&kernel_lock);
+}
+
+static inline void unlock_kernel(void)
+{
+  spin_unlock(&kernel_lock);
+}
+
+#endif /* __SPINLOCK_H__ */
@@ -11,5 +11,91 @@ struct stats
   unsigned long elapsed_total_ticks;
   unsigned long total_trans; /* Number of times the process has got the CPU: READY->RUN transitions */
   unsigned long remaining_ticks;
+  unsigned long full_switches;    /* Switches to the task that reloaded CR3 */
+  unsigned long same_mm_switches; /* Switches from a thread of the same process */
+  unsigned long deadline_misses;  /* EDF jobs not finished by their deadline */
+  unsigned long quantum;          /* Ticks of its last quantum */
+};
+
+/* Structure used by 'get_sched_stats' function */
+struct sched_stats
+{
+  unsigned long rq_ops;         /* Run queue enqueue/dequeue operations since boot */
+  unsigned long rq_ops_per_sec; /* Run queue operations during the last second */
+  unsigned long nr_running;     /* Tasks currently in the run queue */
+  unsigned long mlfq_demotions; /* MLFQ: full slices that made a task sink */
+  unsigned long mlfq_promotions;/* MLFQ: wakeups that made a task climb */
+  unsigned long mlfq_boosts;    /* MLFQ: periodic boosts to level 0 */
+  unsigned long cs_full;        /* Task switches that reloaded CR3 */
+  unsigned long cs_same_mm;     /* Task switches between threads of a process */
+  unsigned long tlb_flushes_avoided; /* Same-mm switches plus switches to idle */
+  unsigned long nr_cpus;        /* CPUs running the scheduler */
+  unsigned long steals;         /* Tasks taken by an idle CPU from another one */
+  unsigned long edf_misses;     /* EDF: jobs not finished by their deadline */
+  unsigned long edf_throttles;  /* EDF: jobs that used up their budget */
+  unsigned long edf_bandwidth;  /* EDF: admitted bandwidth, 1024 is one CPU */
+  unsigned long pi_boosts;      /* Semaphore holders raised to a waiter's priority */
+  unsigned long pi_inversions;  /* Waits for a lower priority semaphore holder */
+  unsigned long pi_inversion_ticks;     /* Total length of those waits */
+  unsigned long pi_max_inversion_ticks; /* Longest one */
+  unsigned long directed_yields; /* CPU handed to a given thread (yield_to) */
+  unsigned long switch_cost;    /* TSC cycles of a task switch, moving average */
+  unsigned long switch_cost_max;/* Slowest task switch measured */
+  unsigned long tick_cycles;    /* TSC cycles per clock tick */
+  unsigned long min_quantum;    /* Shortest quantum keeping the switch overhead bounded */
+};
+
+/* Wakeup-to-run latency buckets: bucket i counts the waits of 2^i up to
+ * 2^(i+1)-1 TSC cycles, the last one also the longer ones */
+#define LAT_BUCKETS 32
+
+/* Structure used by 'get_latency' function */
+struct lat_hist
+{
+  unsigned long count;      /* READY->RUN transitions measured */
+  unsigned long max_cycles; /* Longest wait (saturates at 2^32-1) */
+  unsigned long buckets[LAT_BUCKETS];
+};
+
+/* Block sizes of the physical frame allocator: 2^0 up to 2^10 frames */
+#define BUDDY_ORDERS 11
+
+/* Structure used by 'get_mem_stats' function */
+struct mem_stats
+{
+  unsigned long total_frames; /* Frames above the kernel */
+  unsigned long free_frames;
+  unsigned long free_blocks[BUDDY_ORDERS]; /* Free blocks of 2^i frames */
+  long largest_free_order;    /* Order of the largest free block, -1 if none */
+  unsigned long fragmentation;/* Per mille of the free frames outside the
+                                 largest free block */
+  unsigned long allocs;       /* Blocks allocated */
+  unsigned long failures;     /* Allocations without a large enough block */
+  unsigned long splits;       /* Blocks halved to serve a smaller order */
+  unsigned long merges;       /* Freed blocks joined with their buddy */
+  unsigned long cow_faults;   /* Writes to copy-on-write pages */
+  unsigned long cow_copies;   /* Those that had to copy the frame */
+  unsigned long stack_faults; /* Thread stack pages backed on first touch */
+  unsigned long tlb_invlpgs;  /* Pages dropped from the TLB with invlpg */
+  unsigned long tlb_full_flushes; /* CR3 reloads for more than
+                                     TLB_FLUSH_THRESHOLD pages */
+};
+/* Longest name of a kernel object cache, with the ending 0 */
+#define SLAB_NAME_LEN 16
+
+/* Structure used by 'get_slab_stats' function: one kernel object cache */
+struct slab_stats
+{
+  char name[SLAB_NAME_LEN];
+  unsigned long obj_size;     /* Bytes per object */
+  unsigned long per_slab;     /* Objects per slab */
+  unsigned long slab_frames;  /* Frames per slab */
+  unsigned long slabs;        /* Slabs held */
+  unsigned long active_objs;  /* Objects in use */
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long grows;        /* Slabs taken from the frame allocator */
+  unsigned long shrinks;      /* Slabs given back */
+  unsigned long failures;     /* Allocations without a free frame */
 };
 #endif /* !STATS_H */
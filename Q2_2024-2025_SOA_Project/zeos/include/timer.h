@@ -0,0 +1,45 @@
+/*
+ * timer.h - Kernel timers (hierarchical timer wheel)
+ */
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <list.h>
+
+/**
+ * @brief Kernel timer
+ *
+ * 'function(data)' is called from the clock interrupt once zeos_ticks
+ * reaches 'expires'. Timers already expired when added run at the next
+ * tick. A timer is pending from add_timer() until it runs or del_timer().
+ */
+struct timer_list {
+  struct list_head entry;   /* Slot of the wheel, next == NULL if not pending */
+  unsigned long expires;    /* Absolute tick (zeos_ticks) */
+  void (*function)(unsigned long data);
+  unsigned long data;
+};
+
+/*
+ * The first level has one slot per tick for the next TVR_SIZE ticks. Each
+ * one of the other 4 levels covers TVN_SIZE times the span of the previous
+ * one; their timers are cascaded down one level when the level below wraps.
+ */
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+
+void init_timers(void);
+void init_timer(struct timer_list *timer);
+void add_timer(struct timer_list *timer);
+int del_timer(struct timer_list *timer);
+int timer_pending(struct timer_list *timer);
+
+void run_timers(void);
+int ticks_to_next_timer(int max);
+
+#endif /* __TIMER_H__ */
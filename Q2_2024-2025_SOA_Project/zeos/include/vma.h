@@ -0,0 +1,54 @@
+/*
+ * vma.h - Memory areas of the processes
+ */
+
+#ifndef __VMA_H__
+#define __VMA_H__
+
+#include <list.h>
+#include <types.h>
+
+/* Access allowed to an area */
+#define VM_READ  0x1
+#define VM_WRITE 0x2
+
+/* What backs an area */
+#define VMA_CODE   0
+#define VMA_DATA   1   /* Data, with the stack of the first thread */
+#define VMA_SCREEN 2
+#define VMA_STACK  3   /* Stack of a thread, paged on demand */
+#define VMA_HEAP   4   /* Whole heap zone, in use up to the break */
+#define VMA_SHM    5
+
+/**
+ * @brief Range of logical pages of a process
+ *
+ * The areas of a process are kept in its master thread, sorted by address
+ * and never overlapping: the pages outside them are free. They tell what
+ * the pages are, the page table which frames back them.
+ */
+struct vma {
+  struct list_head list;  /* In the areas of the process */
+  unsigned int start;     /* First page */
+  unsigned int end;       /* Page after the last one */
+  int flags;              /* VM_READ, VM_WRITE */
+  int type;               /* VMA_CODE... */
+  int guard;              /* Pages at the start that are never mapped */
+  void *private;          /* Thread of a stack, segment of a shm area */
+};
+
+struct task_struct;
+
+void init_vma(void);
+struct vma *vma_create(struct task_struct *master, unsigned int start,
+                       unsigned int end, int type, int flags);
+void vma_destroy(struct vma *vma);
+struct vma *find_vma(struct task_struct *master, unsigned int page);
+int vma_find_gap(struct task_struct *master, unsigned int from, int pages);
+int vma_access_ok(struct task_struct *master, unsigned int first,
+                  unsigned int last, int flags);
+int vma_fork(struct task_struct *parent, struct task_struct *child,
+             struct task_struct *caller);
+void vma_exit(struct task_struct *master);
+
+#endif /* __VMA_H__ */
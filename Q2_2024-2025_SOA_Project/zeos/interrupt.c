@@ -8,6 +8,8 @@
 #include <io.h>
 
 #include <sched.h>
+#include <mm.h>
+#include <timer.h>
 
 #include <zeos_interrupt.h>
 
@@ -40,38 +42,70 @@ int zeos_ticks = 0;
 // Keyboard buffer for system calls
 char keyboard_buffer[128];  // Vector of the possible keys -> 1 if pressed 0 if not.
 
-extern struct list_head blocked;
-extern struct list_head readyqueue;
+#ifdef DYNTICKS
+// Length of the programmed one-shot, 0 while the tick is periodic
+static int nohz_ticks = 0;
+// PIT counts elapsed but not yet accounted as a tick, always < LATCH
+// after tick_nohz_idle_exit
+static unsigned int nohz_rest = 0;
+
 /**
- * @brief Updates the remaining pause time of blocked tasks and manages their state transitions
- * 
- * This function is called during each clock tick to:
- * 1. Decrement the pause time of blocked tasks
- * 2. Move tasks that have completed their pause to the ready queue
- * 3. Maintain proper task scheduling based on priorities
- * 
- * The function uses a safe iteration method to handle concurrent modifications
- * of the blocked list during task state transitions.
- * 
- * @return 0 on successful execution
+ * @brief Replaces the periodic tick by a one-shot timer
+ *
+ * Called by the idle task with interrupts disabled. The timer fires at the
+ * next tick with kernel timers to run (or after NOHZ_MAX_TICKS, the longest
+ * count of the PIT). Idle has no quantum to expire. The part of the current
+ * period already elapsed, and the counts left over by the last tickless
+ * period, make the one-shot shorter.
  */
-void update_blocked_time() {
-  struct list_head *pos, *tmp;
-  struct task_struct *t;
-  
-  // Iterate through the blocked list safely
-  list_for_each_safe(pos, tmp, &blocked) {
-    t = list_head_to_task_struct(pos);  
+void tick_nohz_idle_enter(void)
+{
+  unsigned int rest;
+  int next;
 
-    // Decrement the pause time
-    t->pause_time--;
+  if (nohz_ticks > 0)
+    return;
 
-    // If the pause time has elapsed, move the task to the ready queue
-    if (t->pause_time <= 0) {
-      update_process_state_rr(t, &readyqueue);
-    }
+  next = ticks_to_next_timer(NOHZ_MAX_TICKS);
+  rest = nohz_rest + LATCH - get_timer_count();
+  // The next tick is due already
+  if (rest >= next * LATCH)
+    return;
+
+  nohz_rest = rest;
+  nohz_ticks = next;
+  set_timer_oneshot(next * LATCH - rest);
+}
+
+/**
+ * @brief Restores the periodic tick when idle leaves the CPU before the
+ * one-shot expires, catching up the whole ticks elapsed meanwhile
+ *
+ * The fraction of a tick elapsed is kept in nohz_rest for the next tickless
+ * period, so early exits do not make zeos_ticks fall behind.
+ */
+void tick_nohz_idle_exit(void)
+{
+  unsigned int counts;
+  int elapsed;
+
+  // Not tickless, or the expired one-shot is pending: clock_routine catches up
+  if (nohz_ticks == 0 || timer_fired())
+    return;
+
+  counts = nohz_ticks * LATCH - get_timer_count();
+  elapsed = counts / LATCH;
+  nohz_rest = counts % LATCH;
+  nohz_ticks = 0;
+  set_timer_periodic(LATCH);
+  sample_tick_cycles(0);
+
+  if (elapsed > 0) {
+    zeos_ticks += elapsed;
+    run_timers();
   }
 }
+#endif
 
 /**
  * @brief Dumps the screen content to the video memory
@@ -90,20 +124,9 @@ void dumpScreen() {
   }
 }
 
-/**
- * @brief Clock interrupt handler.
- *
- * This routine is called upon a clock interrupt. It updates the ZeOS clock,
- * increments the global tick counter, and triggers the scheduler.
- */
-void clock_routine()
+/* Per-CPU part of a clock tick */
+static void cpu_tick(void)
 {
-  zeos_show_clock();
-  zeos_ticks++;
-  
-  // Update blocked processes
-  update_blocked_time();
-  
   // Update screen if process has a screen page
   struct task_struct *t = current();
 
@@ -115,6 +138,64 @@ void clock_routine()
   schedule();
 }
 
+/**
+ * @brief Clock interrupt handler.
+ *
+ * This routine is called upon a clock interrupt (PIT, CPU 0 only). It
+ * updates the ZeOS clock, increments the global tick counter, and triggers
+ * the scheduler.
+ */
+void clock_routine()
+{
+  int ticks = 1;
+
+#ifdef DYNTICKS
+  // The one-shot of a tickless idle period has expired
+  if (nohz_ticks > 0) {
+    ticks = nohz_ticks;
+    nohz_ticks = 0;
+    nohz_rest = 0;
+    set_timer_periodic(LATCH);
+  }
+#endif
+  sample_tick_cycles(ticks == 1);
+
+  zeos_show_clock();
+  zeos_ticks += ticks;
+  rq_update_rate();
+  
+  // Run the expired kernel timers (wakes up paused tasks)
+  run_timers();
+
+  cpu_tick();
+}
+
+/* Local APIC timer interrupt: the clock tick of the application processors */
+void lapic_timer_routine()
+{
+  cpu_tick();
+}
+
+/**
+ * @brief Reschedule IPI, sent by sched_wakeup() from another CPU
+ *
+ * An idle CPU looks for READY tasks. A busy one leaves the CPU if the
+ * woken up task has to preempt it.
+ */
+void reschedule_routine()
+{
+  struct task_struct *t = current();
+
+  if (is_idle_task(t)) {
+    if (nr_ready > 0)
+      sched_next_rr();
+  }
+  else if (this_cpu()->need_resched) {
+    update_process_state_rr(t, &readyqueue);
+    sched_next_rr();
+  }
+}
+
 /**
  * @brief Keyboard interrupt handler.
  *
@@ -184,28 +265,56 @@ void setTrapHandler(int vector, void (*handler)(), int maxAccessibleFromPL)
 void clock_handler();
 void keyboard_handler();
 void system_call_handler();
+void lapic_timer_handler();
+void reschedule_handler();
+void spurious_handler();
+
+/* Page fault error code bits */
+#define PF_PRESENT 0x1 /* Protection violation, not a missing page */
+#define PF_WRITE   0x2
+#define PF_USER    0x4 /* The access came from user mode */
+
+static inline unsigned long read_cr2(void)
+{
+  unsigned long addr;
+
+  __asm__ __volatile__("movl %%cr2, %0" : "=r" (addr));
+  return addr;
+}
 
 /**
  * Page Fault Exception
  * 
- * Handles page fault exceptions in the system. When a page fault occurs,
- * it prints the address (EIP) where the fault happened in hexadecimal format
+ * Handles page fault exceptions in the system. A write to a copy-on-write
+ * page (from user mode, or from the kernel through copy_to_user) or the
+ * first touch of a thread stack page is resolved and the faulting
+ * instruction restarts. Any other page fault (a guard page included)
+ * prints the address (EIP) where the fault happened in hexadecimal format
  * and halts the system.
  *
  * The routine performs the following:
  * - Receives the error code and EIP (instruction pointer) where fault occurred
- * - Prints a diagnostic message with the EIP in hexadecimal format
- * - Halts the system in an infinite loop
+ * - Gives a private copy of a copy-on-write page to the writer
+ * - Backs a thread stack page with a zeroed frame
+ * - Otherwise, prints a diagnostic message with the EIP in hexadecimal format
+ *   and halts the system in an infinite loop
  * 
  * Parameters:
- * @param error - Error code provided by CPU (unused)
+ * @param error - Error code provided by CPU
  * @param EIP   - Program counter value when the page fault occurred (only for routine)
  *
- * @note After printing the fault address, the system enters an infinite loop.
- *       This is a fatal error handler - execution does not continue.
+ * @note The kernel lock is taken by the handler when the fault comes from
+ *       user mode, and is already held when it comes from the kernel.
  */
 void _page_fault_handler(void);                                           //HANDLER
 void _page_fault_routine(unsigned long error, unsigned long EIP){         //ROUTINE
+  if ((error & (PF_PRESENT | PF_WRITE)) == (PF_PRESENT | PF_WRITE) &&
+      cow_fault(read_cr2(), error & PF_USER))
+    return;
+
+  if (!(error & PF_PRESENT) && stack_fault(read_cr2()))
+    return;
+
   printk("\n");
   printk("Procces generates a PAGE FAULT exception at EIP: 0x");
   
@@ -247,6 +356,10 @@ void setIdt()
 
   setInterruptHandler(14, _page_fault_handler, 0);
 
+  setInterruptHandler(LAPIC_TIMER_VECTOR, lapic_timer_handler, 0);
+  setInterruptHandler(RESCHEDULE_VECTOR, reschedule_handler, 0);
+  setInterruptHandler(SPURIOUS_VECTOR, spurious_handler, 0);
+
   setSysenter();
 
   set_idt_reg(&idtR);
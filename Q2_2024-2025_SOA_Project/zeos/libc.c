@@ -52,3 +52,71 @@ void perror()
 
   write(1, buffer, strlen(buffer));
 }
+
+/* Bucket of 'h' holding its 'pct' percentile (waits under 2^(bucket+1)
+ * cycles), -1 if it is empty */
+int lat_percentile(struct lat_hist *h, int pct)
+{
+  unsigned long long seen = 0;
+  int i;
+
+  if (h->count == 0)
+    return -1;
+
+  for (i = 0; i < LAT_BUCKETS - 1; i++) {
+    seen += h->buckets[i];
+    if (seen * 100 >= (unsigned long long)h->count * pct)
+      break;
+  }
+  return i;
+}
+
+/* Returns the previous value of '*p', storing 'new' if it was 'old' */
+static inline int cmpxchg(volatile int *p, int old, int new)
+{
+  int prev;
+
+  __asm__ __volatile__("lock cmpxchgl %2, %1"
+                       : "=a" (prev), "+m" (*p)
+                       : "r" (new), "0" (old)
+                       : "memory");
+  return prev;
+}
+
+static inline void atomic_add(volatile int *p, int v)
+{
+  __asm__ __volatile__("lock addl %1, %0" : "+m" (*p) : "ir" (v) : "memory");
+}
+
+void fsem_init(fsem_t *s, int value)
+{
+  s->value = value;
+  s->waiters = 0;
+}
+
+void fsem_wait(fsem_t *s)
+{
+  int v;
+
+  for (;;) {
+    // Fast path: take a unit without the kernel
+    v = s->value;
+    if (v > 0) {
+      if (cmpxchg(&s->value, v, v - 1) == v)
+        return;
+      continue;
+    }
+
+    // Sleep while it is 0. A post in between makes futex_wait return
+    atomic_add(&s->waiters, 1);
+    futex_wait((int *)&s->value, 0);
+    atomic_add(&s->waiters, -1);
+  }
+}
+
+void fsem_post(fsem_t *s)
+{
+  atomic_add(&s->value, 1);
+  if (s->waiters > 0)
+    futex_wake((int *)&s->value, 1);
+}
@@ -0,0 +1,261 @@
+/*
+ * malloc.c - Heap of the user programs
+ *
+ * The memory comes from sbrk() in whole pages. Blocks up to MALLOC_MAX_SMALL
+ * bytes are rounded up to a power of two size class and carved from pages
+ * of only that class, so they need no header: free() finds the class from
+ * page_class[]. Each class has a free list shared by the threads, under
+ * 'heap_lock', and every thread a cache of a few free blocks of each class
+ * that it takes and gives back without the lock. Larger blocks are runs of
+ * whole pages, reused first fit.
+ *
+ * There is no thread local storage: the cache of a thread is found from the
+ * page its stack pointer is in. The thread stacks never share a page, so a
+ * cache is only used by the thread whose stack has that page.
+ */
+
+#include <libc.h>
+#include <types.h>
+#include <mm_address.h>
+
+#define MALLOC_MIN_SHIFT 4
+#define MALLOC_CLASSES 8          /* 16 to 2048 bytes */
+#define MALLOC_MAX_SMALL (1 << (MALLOC_MIN_SHIFT + MALLOC_CLASSES - 1))
+
+/* Caches of the threads: free blocks kept per class, and moved at once
+ * from and to the shared lists when empty or full */
+#define TCACHE_SLOTS 32
+#define TCACHE_MAX 16
+#define TCACHE_BATCH 8
+
+/* page_class[] besides the class + 1 of the small blocks */
+#define PAGE_UNUSED 0
+#define PAGE_LARGE 0xFF
+
+#define HEAP_BASE (PAG_LOG_INIT_HEAP << 12)
+#define heap_page(p) (((unsigned int)(p) - HEAP_BASE) >> 12)
+
+struct free_block {
+  struct free_block *next;
+};
+
+/* Free run of pages, in the list of runs sorted by address */
+struct free_run {
+  struct free_run *next;
+  int pages;
+};
+
+struct tcache {
+  unsigned int stack_page;      /* Page of the stack of its thread, 0 if free */
+  int count[MALLOC_CLASSES];
+  struct free_block *head[MALLOC_CLASSES];
+};
+
+static fsem_t heap_lock = { 1, 0 };
+static struct free_block *free_lists[MALLOC_CLASSES];
+static struct free_run *free_runs;
+static unsigned char page_class[NUM_PAG_HEAP];
+static int page_run[NUM_PAG_HEAP];      /* Pages of the large block there */
+static struct tcache tcaches[TCACHE_SLOTS];
+
+static int size_class(int size)
+{
+  int c = 0;
+
+  while ((1 << (MALLOC_MIN_SHIFT + c)) < size)
+    c++;
+  return c;
+}
+
+/* Cache of the calling thread, or NULL if it has none. With 'claim' (and
+ * the lock held) a free slot is taken for it */
+static struct tcache *find_tcache(int claim)
+{
+  unsigned int page = (unsigned int)&page >> 12;
+  struct tcache *tc = &tcaches[page % TCACHE_SLOTS];
+
+  if (tc->stack_page == page)
+    return tc;
+  if (claim && tc->stack_page == 0) {
+    tc->stack_page = page;
+    return tc;
+  }
+  return NULL;
+}
+
+/* 'n' new pages at the end of the heap, or NULL */
+static void *get_pages(int n)
+{
+  unsigned int brk = (unsigned int)sbrk(0);
+  int pad = (PAGE_SIZE - (brk & (PAGE_SIZE - 1))) & (PAGE_SIZE - 1);
+  char *p = sbrk(pad + n * PAGE_SIZE);
+
+  if (p == (void *)-1)
+    return NULL;
+  return p + pad;
+}
+
+/* Carves a new page in blocks of class 'c' for its shared list */
+static int grow_class(int c)
+{
+  int size = 1 << (MALLOC_MIN_SHIFT + c);
+  char *p = get_pages(1);
+  int i;
+
+  if (p == NULL)
+    return -1;
+
+  page_class[heap_page(p)] = c + 1;
+  for (i = PAGE_SIZE - size; i >= 0; i -= size) {
+    struct free_block *b = (struct free_block *)(p + i);
+
+    b->next = free_lists[c];
+    free_lists[c] = b;
+  }
+  return 0;
+}
+
+static void *large_alloc(int size)
+{
+  int n = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+  struct free_run **pr, *r;
+  char *p = NULL;
+
+  fsem_wait(&heap_lock);
+  for (pr = &free_runs; *pr != NULL; pr = &(*pr)->next) {
+    r = *pr;
+    if (r->pages < n)
+      continue;
+    // The tail of the run, the rest stays where it is
+    r->pages -= n;
+    p = (char *)r + r->pages * PAGE_SIZE;
+    if (r->pages == 0)
+      *pr = r->next;
+    break;
+  }
+  if (p == NULL)
+    p = get_pages(n);
+  if (p != NULL) {
+    page_class[heap_page(p)] = PAGE_LARGE;
+    page_run[heap_page(p)] = n;
+  }
+  fsem_post(&heap_lock);
+  return p;
+}
+
+/* Called with the lock held */
+static void large_free(void *p)
+{
+  struct free_run *r = p, *prev = NULL, *next = free_runs;
+
+  r->pages = page_run[heap_page(p)];
+  page_class[heap_page(p)] = PAGE_UNUSED;
+
+  while (next != NULL && next < r) {
+    prev = next;
+    next = next->next;
+  }
+
+  // Merged with the runs next to it
+  if (next != NULL && (char *)r + r->pages * PAGE_SIZE == (char *)next) {
+    r->pages += next->pages;
+    next = next->next;
+  }
+  r->next = next;
+  if (prev != NULL && (char *)prev + prev->pages * PAGE_SIZE == (char *)r) {
+    prev->pages += r->pages;
+    prev->next = r->next;
+  }
+  else if (prev != NULL)
+    prev->next = r;
+  else
+    free_runs = r;
+}
+
+/* Returns 'size' bytes of memory, or NULL if the heap is full */
+void *malloc(int size)
+{
+  struct tcache *tc;
+  struct free_block *b;
+  int c, i;
+
+  if (size <= 0)
+    return NULL;
+  if (size > MALLOC_MAX_SMALL)
+    return large_alloc(size);
+
+  c = size_class(size);
+  tc = find_tcache(0);
+  if (tc != NULL && tc->head[c] != NULL) {
+    b = tc->head[c];
+    tc->head[c] = b->next;
+    tc->count[c]--;
+    return b;
+  }
+
+  fsem_wait(&heap_lock);
+  tc = find_tcache(1);
+
+  // Refill the cache of the thread, and take one of them
+  for (i = 0; i < (tc != NULL ? TCACHE_BATCH : 1); i++) {
+    if (free_lists[c] == NULL && grow_class(c) < 0)
+      break;
+    b = free_lists[c];
+    free_lists[c] = b->next;
+    if (tc == NULL) {
+      fsem_post(&heap_lock);
+      return b;
+    }
+    b->next = tc->head[c];
+    tc->head[c] = b;
+    tc->count[c]++;
+  }
+  fsem_post(&heap_lock);
+
+  b = tc != NULL ? tc->head[c] : NULL;
+  if (b != NULL) {
+    tc->head[c] = b->next;
+    tc->count[c]--;
+  }
+  return b;
+}
+
+void free(void *p)
+{
+  struct free_block *b = p;
+  struct tcache *tc;
+  int c, i;
+
+  if (p == NULL)
+    return;
+
+  if (page_class[heap_page(p)] == PAGE_LARGE) {
+    fsem_wait(&heap_lock);
+    large_free(p);
+    fsem_post(&heap_lock);
+    return;
+  }
+
+  c = page_class[heap_page(p)] - 1;
+  tc = find_tcache(0);
+  if (tc != NULL && tc->count[c] < TCACHE_MAX) {
+    b->next = tc->head[c];
+    tc->head[c] = b;
+    tc->count[c]++;
+    return;
+  }
+
+  // Back to the shared list, with a batch of the full cache
+  fsem_wait(&heap_lock);
+  for (i = 0; tc != NULL && i < TCACHE_BATCH; i++) {
+    struct free_block *o = tc->head[c];
+
+    tc->head[c] = o->next;
+    tc->count[c]--;
+    o->next = free_lists[c];
+    free_lists[c] = o;
+  }
+  b->next = free_lists[c];
+  free_lists[c] = b;
+  fsem_post(&heap_lock);
+}
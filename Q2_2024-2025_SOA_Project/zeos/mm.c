@@ -7,8 +7,27 @@
 #include <segment.h>
 #include <hardware.h>
 #include <sched.h>
-
-Byte phys_mem[TOTAL_PAGES];
+#include <utils.h>
+#include <slab.h>
+#include <vma.h>
+
+/* Buddy allocator of the physical pages: a free block of 2^k frames
+ * (order k) starts at a multiple of 2^k and is kept in free_area[k] */
+struct frame {
+  struct list_head list; /* In free_area[order] while it heads a free block */
+  unsigned short state;  /* FREE_FRAME, or the page table entries mapping it
+                            (USED_FRAME once allocated), up to MAX_FRAME_REFS */
+  Byte order;            /* Order of the free block it heads, NO_ORDER if it
+                            does not head one */
+  void *private;         /* Owner of an allocated frame (the slab it holds) */
+};
+
+#define NO_ORDER 0xFF
+#define MAX_FRAME_REFS 0xFFFF
+
+static struct frame frames[TOTAL_PAGES];
+static struct list_head free_area[MAX_ORDER+1];
+static struct mem_stats buddy;
 
 /* SEGMENTATION */
 /* Memory segements description table */
@@ -19,10 +38,12 @@ Register    gdtR;
 /* PAGING */
 /* Variables containing the page directory and the page table */
   
-page_table_entry dir_pages[NR_TASKS][TOTAL_PAGES]
+/* Directory and page table of the boot, used by the idle tasks. Every
+ * other directory is a copy of them, in frames of its own (new_DIR) */
+page_table_entry dir_pages[TOTAL_PAGES]
   __attribute__((__section__(".data.task")));
 
-page_table_entry pagusr_table[NR_TASKS][TOTAL_PAGES]
+page_table_entry pagusr_table[TOTAL_PAGES]
   __attribute__((__section__(".data.task")));
 
 /* TSS */
@@ -38,41 +59,52 @@ TSS         tss;
   
 void init_dir_pages()
 {
-int i;
-
-for (i = 0; i< NR_TASKS; i++) {
-  dir_pages[i][ENTRY_DIR_PAGES].entry = 0;
-  dir_pages[i][ENTRY_DIR_PAGES].bits.pbase_addr = (((unsigned int)&pagusr_table[i]) >> 12);
-  dir_pages[i][ENTRY_DIR_PAGES].bits.user = 1;
-  dir_pages[i][ENTRY_DIR_PAGES].bits.rw = 1;
-  dir_pages[i][ENTRY_DIR_PAGES].bits.present = 1;
-
-}
-
+  int i;
+
+  for (i = 0; i < TOTAL_PAGES; i++)
+    dir_pages[i].entry = 0;
+
+  dir_pages[ENTRY_DIR_PAGES].bits.pbase_addr = (((unsigned int)pagusr_table) >> 12);
+  dir_pages[ENTRY_DIR_PAGES].bits.user = 1;
+  dir_pages[ENTRY_DIR_PAGES].bits.rw = 1;
+  dir_pages[ENTRY_DIR_PAGES].bits.present = 1;
+
+  /* Kernel window: all the frames, as one 4 MB page (CR4.PSE) kept in the
+   * TLB across CR3 writes */
+  dir_pages[ENTRY_DIR_KMEM].bits.pbase_addr = 0;
+  dir_pages[ENTRY_DIR_KMEM].bits.ps_pat = 1;
+  dir_pages[ENTRY_DIR_KMEM].bits.global = 1;
+  dir_pages[ENTRY_DIR_KMEM].bits.rw = 1;
+  dir_pages[ENTRY_DIR_KMEM].bits.present = 1;
+
+  /* Its entries are only made if there is a local APIC (see smp.c) */
+  dir_pages[LAPIC_BASE >> 22].bits.pbase_addr = (((unsigned int)lapic_table) >> 12);
+  dir_pages[LAPIC_BASE >> 22].bits.rw = 1;
+  dir_pages[LAPIC_BASE >> 22].bits.present = 1;
 }
 
 /* Initializes the page table (kernel pages only) */
 void init_table_pages()
 {
-  int i,j;
+  int i;
   /* reset all entries */
-for (j=0; j< NR_TASKS; j++) {
   for (i=0; i<TOTAL_PAGES; i++)
     {
-      pagusr_table[j][i].entry = 0;
+      pagusr_table[i].entry = 0;
     }
   /* Init kernel pages */
   for (i=1; i<NUM_PAG_KERNEL; i++) // Leave the page inaccessible to comply with NULL convention 
     {
       // Logical page equal to physical page (frame)
-      pagusr_table[j][i].bits.pbase_addr = i;
-      pagusr_table[j][i].bits.rw = 1;
-      pagusr_table[j][i].bits.present = 1;
+      pagusr_table[i].bits.pbase_addr = i;
+      pagusr_table[i].bits.rw = 1;
+      pagusr_table[i].bits.present = 1;
+      // The same in every address space: kept in the TLB across CR3 writes
+      pagusr_table[i].bits.global = 1;
     }
   /* Protect the task array by using a couple of invalid pages before and after the task array */
-  pagusr_table[j][PH_PAGE((DWord)(&protected_tasks[0]))].bits.present = 0;
-  pagusr_table[j][PH_PAGE((DWord)(&protected_tasks[11]))].bits.present = 0;
-}
+  pagusr_table[PH_PAGE((DWord)(&protected_tasks[0]))].bits.present = 0;
+  pagusr_table[PH_PAGE((DWord)(&protected_tasks[NR_BOOT_TASKS+1]))].bits.present = 0;
 }
 
 
@@ -108,7 +140,9 @@ void set_user_pages( struct task_struct *task )
 /* Writes on CR3 register producing a TLB flush */
 void set_cr3(page_table_entry * dir)
 {
- 	asm volatile("movl %0,%%cr3": :"r" (dir));
+ 	asm volatile("movl %0,%%cr3": :"r" (kaddr_phys(dir)));
+ 	this_cpu()->active_dir = dir;
+ 	this_cpu()->loaded_dir = dir;
 }
 
 /* Macros for reading/writing the CR0 register, where is shown the paging status */
@@ -130,15 +164,45 @@ void set_pe_flag()
   write_cr0(cr0);
 }
 
+#define read_cr4() ({ \
+         unsigned int __dummy; \
+         __asm__( \
+                 "movl %%cr4,%0\n\t" \
+                 :"=r" (__dummy)); \
+         __dummy; \
+})
+#define write_cr4(x) \
+         __asm__("movl %0,%%cr4": :"r" (x));
+
+/* Enables the 4 MB pages (CR4.PSE) of the kernel window, and the global
+ * pages (CR4.PGE): a CR3 write no longer drops the kernel from the TLB */
+void set_pse_pge_flags()
+{
+  unsigned int cr4 = read_cr4();
+  cr4 |= CR4_PSE | CR4_PGE;
+  write_cr4(cr4);
+}
+
+/* Makes the read-only pages read-only for the kernel too (CR0.WP), so its
+ * writes to copy-on-write pages fault as well. Once the user code is in
+ * place */
+void set_wp_flag()
+{
+  unsigned int cr0 = read_cr0();
+  cr0 |= CR0_WP;
+  write_cr0(cr0);
+}
+
 /* Initializes paging for the system address space */
 void init_mm()
 {
   init_table_pages();
   init_frames();
   init_dir_pages();
-  allocate_DIR(&task[0].task);
-  set_cr3(get_DIR(&task[0].task));
+  set_pse_pge_flags();
+  set_cr3(dir_pages);
   set_pe_flag();
+  init_slab();
 }
 /***********************************************/
 /************** SEGMENTATION MANAGEMENT ********/
@@ -193,37 +257,242 @@ void setTSS()
 }
 
  
-/* Initializes the ByteMap of free physical pages.
- * The kernel pages are marked as used */
+/* Marks the 2^order frames from 'frame' */
+static void mark_frames(unsigned int frame, int order, Byte state)
+{
+  int i;
+
+  for (i = 0; i < (1 << order); i++) {
+    frames[frame + i].state = state;
+    frames[frame + i].order = NO_ORDER;
+    frames[frame + i].private = NULL;
+  }
+}
+
+static void add_free_block(unsigned int frame, int order)
+{
+  frames[frame].order = order;
+  list_add(&frames[frame].list, &free_area[order]);
+  buddy.free_blocks[order]++;
+}
+
+static void del_free_block(unsigned int frame, int order)
+{
+  frames[frame].order = NO_ORDER;
+  list_del(&frames[frame].list);
+  buddy.free_blocks[order]--;
+}
+
+/* Initializes the free lists with the frames above the kernel, in the
+ * largest aligned blocks that fit */
 int init_frames( void )
 {
-    int i;
-    /* Mark pages as Free */
-    for (i=0; i<TOTAL_PAGES; i++) {
-        phys_mem[i] = FREE_FRAME;
+    unsigned int frame;
+    int order;
+
+    for (order = 0; order <= MAX_ORDER; order++)
+        INIT_LIST_HEAD(&free_area[order]);
+
+    /* The kernel frames are never freed */
+    for (frame = 0; frame < TOTAL_PAGES; frame++) {
+        frames[frame].state = USED_FRAME;
+        frames[frame].order = NO_ORDER;
+        frames[frame].private = NULL;
     }
-    /* Mark kernel pages as Used */
-    for (i=0; i<NUM_PAG_KERNEL; i++) {
-        phys_mem[i] = USED_FRAME;
+
+    for (frame = NUM_PAG_KERNEL; frame < TOTAL_PAGES; frame += 1 << order) {
+        for (order = MAX_ORDER; order > 0; order--)
+            if ((frame & ((1 << order) - 1)) == 0 && frame + (1 << order) <= TOTAL_PAGES)
+                break;
+        mark_frames(frame, order, FREE_FRAME);
+        add_free_block(frame, order);
     }
+
+    buddy.total_frames = TOTAL_PAGES - NUM_PAG_KERNEL;
+    buddy.free_frames = buddy.total_frames;
     return 0;
 }
 
-/* alloc_frame - Search a free physical page (== frame) and mark it as USED_FRAME. 
+/**
+ * @brief Allocates 2^order physically contiguous frames
+ *
+ * Takes the smallest free block that is large enough and splits it, giving
+ * back the unused halves to the lower orders.
+ *
+ * @return The first frame, aligned to 2^order, or -1 if no block is large
+ *         enough
+ */
+int alloc_frames( int order )
+{
+    unsigned int frame;
+    int k;
+
+    if (order < 0 || order > MAX_ORDER)
+        return -1;
+
+    for (k = order; k <= MAX_ORDER && list_empty(&free_area[k]); k++)
+        ;
+    if (k > MAX_ORDER) {
+        buddy.failures++;
+        return -1;
+    }
+
+    frame = list_entry(list_first(&free_area[k]), struct frame, list) - frames;
+    del_free_block(frame, k);
+
+    while (k > order) {
+        k--;
+        add_free_block(frame + (1 << k), k);
+        buddy.splits++;
+    }
+
+    mark_frames(frame, order, USED_FRAME);
+    buddy.free_frames -= 1 << order;
+    buddy.allocs++;
+    return frame;
+}
+
+/**
+ * @brief Frees 2^order frames from 'frame', merging them with their buddies
+ *
+ * Any aligned part of an allocated block can be freed on its own, down to
+ * single frames: the block rebuilds itself as its parts come back.
+ */
+void free_frames( unsigned int frame, int order )
+{
+    unsigned int buddy_frame;
+
+    if (order < 0 || order > MAX_ORDER || frame < NUM_PAG_KERNEL ||
+        frame + (1 << order) > TOTAL_PAGES || (frame & ((1 << order) - 1)) ||
+        frames[frame].state != USED_FRAME)
+        return;
+
+    mark_frames(frame, order, FREE_FRAME);
+    buddy.free_frames += 1 << order;
+
+    for (; order < MAX_ORDER; order++) {
+        buddy_frame = frame ^ (1 << order);
+        if (buddy_frame + (1 << order) > TOTAL_PAGES ||
+            frames[buddy_frame].state != FREE_FRAME ||
+            frames[buddy_frame].order != order)
+            break;
+
+        del_free_block(buddy_frame, order);
+        if (buddy_frame < frame)
+            frame = buddy_frame;
+        buddy.merges++;
+    }
+    add_free_block(frame, order);
+}
+
+/* alloc_frame - Allocates a physical page (== frame).
  * Returns the frame number or -1 if there isn't any frame available. */
 int alloc_frame( void )
 {
-    int i;
-    for (i=NUM_PAG_KERNEL; i<TOTAL_PAGES;) {
-        if (phys_mem[i] == FREE_FRAME) {
-            phys_mem[i] = USED_FRAME;
-            return i;
+    return alloc_frames(0);
+}
+
+/**
+ * @brief Allocates 'nr' physically contiguous frames, the tail of the
+ * power of two block they come from goes back to the free lists
+ * @return The first frame, or -1 if there is no such run
+ */
+int alloc_frame_run( int nr )
+{
+    int order = 0, frame, i;
+
+    if (nr <= 0)
+        return -1;
+
+    while ((1 << order) < nr)
+        order++;
+
+    frame = alloc_frames(order);
+    if (frame < 0)
+        return -1;
+
+    for (i = nr; i < (1 << order); i++)
+        free_frame(frame + i);
+    return frame;
+}
+
+/* Fills the allocator part of 's' */
+void get_mem_stats( struct mem_stats *s )
+{
+    int order, largest = -1;
+
+    *s = buddy;
+    for (order = MAX_ORDER; order >= 0; order--)
+        if (buddy.free_blocks[order] > 0) {
+            largest = order;
+            break;
         }
-        i += 2; /* NOTE: There will be holes! This is intended. 
-			DO NOT MODIFY! */
+
+    s->largest_free_order = largest;
+    /* Share of the free memory outside the largest free block */
+    s->fragmentation = buddy.free_frames == 0 ? 0 :
+        1000 - (1000 << largest) / buddy.free_frames;
+}
+
+/**
+ * @brief Makes a new address space: a directory and its page table, with
+ * the kernel mapped as in the boot one and no user page
+ * @return The directory, or NULL if there are not 2 free frames
+ */
+page_table_entry *new_DIR( void )
+{
+    page_table_entry *dir, *PT;
+    int dir_frame, pt_frame;
+
+    dir_frame = alloc_frame();
+    if (dir_frame < 0)
+        return NULL;
+    pt_frame = alloc_frame();
+    if (pt_frame < 0) {
+        free_frame(dir_frame);
+        return NULL;
     }
 
-    return -1;
+    dir = frame_to_kaddr(dir_frame);
+    PT = frame_to_kaddr(pt_frame);
+    copy_data(dir_pages, dir, PAGE_SIZE);
+    dir[ENTRY_DIR_PAGES].bits.pbase_addr = pt_frame;
+    copy_data(pagusr_table, PT, PAGE_SIZE);
+    return dir;
+}
+
+/* Adds a user (a thread) to the address space 'dir'. Returns -1 if it
+ * has too many already */
+int share_DIR( page_table_entry *dir )
+{
+    if (dir == dir_pages)
+        return 0;
+    return share_frame(kaddr_to_frame(dir));
+}
+
+/**
+ * @brief Drops a user of the address space 'dir', freeing its frames with
+ * the last one. Its user pages must have been freed already
+ * @return 0 if it is the last one but 'dir' is still in the CR3 of a CPU
+ *         (an idle CPU keeps the last one): nothing is done then
+ */
+int put_DIR( page_table_entry *dir )
+{
+    unsigned int dir_frame;
+    int i;
+
+    if (dir == dir_pages)
+        return 1;
+
+    dir_frame = kaddr_to_frame(dir);
+    if (frame_refs(dir_frame) == USED_FRAME) {
+        for (i = 0; i < MAX_CPUS; i++)
+            if (cpus[i].loaded_dir == dir)
+                return 0;
+        free_frame(dir[ENTRY_DIR_PAGES].bits.pbase_addr);
+    }
+    free_frame(dir_frame);
+    return 1;
 }
 
 void free_user_pages( struct task_struct *task )
@@ -238,11 +507,44 @@ void free_user_pages( struct task_struct *task )
 }
 
 
-/* free_frame - Mark as FREE_FRAME the frame  'frame'.*/
+/* free_frame - Drops a reference to the frame 'frame', freeing it with the
+ * last one.*/
 void free_frame( unsigned int frame )
 {
-    if ((frame>NUM_PAG_KERNEL)&&(frame<TOTAL_PAGES))
-      phys_mem[frame]=FREE_FRAME;
+    if (frame < TOTAL_PAGES && frames[frame].state > USED_FRAME) {
+        frames[frame].state--;
+        return;
+    }
+    free_frames(frame, 0);
+}
+
+/* Adds a reference to the allocated frame 'frame'. Returns -1, and adds
+ * none, if it has MAX_FRAME_REFS already */
+int share_frame( unsigned int frame )
+{
+    if (frame < NUM_PAG_KERNEL || frame >= TOTAL_PAGES ||
+        frames[frame].state == FREE_FRAME)
+        return 0;
+    if (frames[frame].state == MAX_FRAME_REFS)
+        return -1;
+    frames[frame].state++;
+    return 0;
+}
+
+/* Page table entries mapping 'frame' */
+int frame_refs( unsigned int frame )
+{
+    return frames[frame].state;
+}
+
+void set_frame_private( unsigned int frame, void *p )
+{
+    frames[frame].private = p;
+}
+
+void *frame_private( unsigned int frame )
+{
+    return frames[frame].private;
 }
 
 /* set_ss_pag - Associates logical page 'page' with physical page 'frame' */
@@ -266,3 +568,186 @@ void del_ss_pag(page_table_entry *PT, unsigned logical_page)
 unsigned int get_frame (page_table_entry *PT, unsigned int logical_page){
      return PT[logical_page].bits.pbase_addr; 
 }
+
+/***********************************************/
+/************** TLB INVALIDATION ***************/
+/***********************************************/
+
+/* Drops the entry of the logical page 'page' from the TLB of this CPU */
+static inline void invlpg(unsigned int page)
+{
+  __asm__ __volatile__("invlpg (%0)" : : "r" (page << 12) : "memory");
+}
+
+void tlb_batch_init(struct tlb_batch *b, page_table_entry *dir)
+{
+  b->dir = dir;
+  b->nr = 0;
+}
+
+/* Queues 'page', whose entry in b->dir has been changed or removed */
+void tlb_batch_add(struct tlb_batch *b, unsigned int page)
+{
+  if (b->nr < TLB_FLUSH_THRESHOLD)
+    b->pages[b->nr] = page;
+  b->nr++;
+}
+
+/**
+ * @brief Drops the pages queued in 'b' from the TLBs
+ *
+ * This CPU invalidates them one by one, or reloads CR3 if there are more
+ * than TLB_FLUSH_THRESHOLD. It has nothing to drop if b->dir is not loaded
+ * here: loading another directory flushed it. The other CPUs running the
+ * address space flush their whole TLB at their next kernel entry
+ * (flush_tlb_mm).
+ */
+void tlb_batch_flush(struct tlb_batch *b)
+{
+  int i;
+
+  if (b->nr == 0)
+    return;
+
+  if (this_cpu()->loaded_dir == b->dir) {
+    if (b->nr > TLB_FLUSH_THRESHOLD) {
+      set_cr3(b->dir);
+      buddy.tlb_full_flushes++;
+    }
+    else {
+      for (i = 0; i < b->nr; i++)
+        invlpg(b->pages[i]);
+      buddy.tlb_invlpgs += b->nr;
+    }
+  }
+  flush_tlb_mm(b->dir);
+  b->nr = 0;
+}
+
+/***********************************************/
+/************** COPY-ON-WRITE ******************/
+/***********************************************/
+
+/* Shares logical page 'page' of 'src' with 'dst', read-only in both until
+ * one of them writes it. A stack page not touched yet stays unmapped in
+ * both. Returns -1, and changes nothing, if the frame has too many
+ * references */
+int share_cow_page(page_table_entry *src, page_table_entry *dst, unsigned page)
+{
+  if (!src[page].bits.present)
+    return 0;
+  if (share_frame(src[page].bits.pbase_addr) < 0)
+    return -1;
+
+  src[page].bits.rw = 0;
+  src[page].bits.avail |= PTE_COW;
+  dst[page] = src[page];
+  return 0;
+}
+
+/**
+ * @brief Resolves a write to a read-only page of the running process
+ *
+ * A copy-on-write page still shared gets a private copy of its frame; the
+ * last process mapping it just makes it writable again.
+ *
+ * @param addr Faulting address
+ * @param user The write came from user mode (U/S bit of the error code)
+ * @return 1 if the write can be retried, 0 if the page is not copy-on-write
+ *         or there is no free frame for the copy
+ */
+int cow_fault(unsigned long addr, int user)
+{
+  page_table_entry *dir = get_DIR(current());
+  page_table_entry *PT = get_PT(current());
+  unsigned int page = addr >> 12;
+  struct tlb_batch tlb;
+  unsigned int frame;
+  int new_frame;
+
+  if (page >= TOTAL_PAGES || !PT[page].bits.present)
+    return 0;
+
+  // A supervisor page written from user mode is a real protection fault
+  if (user && !PT[page].bits.user)
+    return 0;
+
+  // Already resolved by another thread of the process: only the entry in
+  // this TLB is stale. Supervisor pages are never copy-on-write
+  if (PT[page].bits.rw && PT[page].bits.user) {
+    invlpg(page);
+    buddy.tlb_invlpgs++;
+    return 1;
+  }
+
+  if (!(PT[page].bits.avail & PTE_COW))
+    return 0;
+
+  buddy.cow_faults++;
+  frame = PT[page].bits.pbase_addr;
+  if (frame_refs(frame) > USED_FRAME) {
+    new_frame = alloc_frame();
+    if (new_frame < 0)
+      return 0;
+    // Frame to frame, through the kernel window
+    copy_data(frame_to_kaddr(frame), frame_to_kaddr(new_frame), PAGE_SIZE);
+    PT[page].bits.pbase_addr = new_frame;
+    free_frame(frame);
+    buddy.cow_copies++;
+  }
+
+  PT[page].bits.rw = 1;
+  PT[page].bits.avail &= ~PTE_COW;
+
+  // The other CPUs only need to forget the old frame: a read-only entry of
+  // the same one just faults again (resolved above)
+  if (frame == PT[page].bits.pbase_addr) {
+    invlpg(page);
+    buddy.tlb_invlpgs++;
+  }
+  else {
+    tlb_batch_init(&tlb, dir);
+    tlb_batch_add(&tlb, page);
+    tlb_batch_flush(&tlb);
+  }
+  return 1;
+}
+
+/***********************************************/
+/************** DEMAND-PAGED STACKS ************/
+/***********************************************/
+
+/**
+ * @brief Backs the page of a thread stack touched for the first time
+ *
+ * The stacks of the threads are reserved by sys_clone (VMA_STACK areas) but
+ * only get a frame, zeroed, when one of the threads of the process (or the
+ * kernel on their behalf) touches the page. The guard pages are never backed.
+ *
+ * @param addr Faulting address
+ * @return 1 if the access can be retried, 0 if 'addr' is not in a thread
+ *         stack of the running process or there is no free frame
+ */
+int stack_fault(unsigned long addr)
+{
+  page_table_entry *PT = get_PT(current());
+  unsigned int page = addr >> 12;
+  struct vma *vma;
+  int frame;
+
+  if (page >= TOTAL_PAGES || PT[page].bits.present)
+    return 0;
+
+  vma = find_vma(current()->master_thread, page);
+  if (vma == NULL || vma->type != VMA_STACK || page < vma->start + vma->guard)
+    return 0;
+
+  frame = alloc_frame();
+  if (frame < 0)
+    return 0;
+
+  memset(frame_to_kaddr(frame), 0, PAGE_SIZE);
+  set_ss_pag(PT, page, frame);
+  buddy.stack_faults++;
+  return 1;
+}
@@ -7,18 +7,28 @@
 #include <segment.h>
 #include <sched.h>
 #include <mm.h>
+#include <shm.h>
+#include <vma.h>
 #include <io.h>
 #include <utils.h>
 #include <p_stats.h>
+#include <interrupt.h>
+#include <errno.h>
 
 /**
- * Container for the Task array and 2 additional pages (the first and the last one)
+ * Container for the boot task slots and 2 additional pages (the first and the last one)
  * to protect against out of bound accesses.
  */
-union task_union protected_tasks[NR_TASKS+2]
+union task_union protected_tasks[NR_BOOT_TASKS+2]
   __attribute__((__section__(".data.task")));
 
-union task_union *task = &protected_tasks[1]; /* == union task_union task[NR_TASKS] */
+union task_union *task = &protected_tasks[1]; /* == union task_union task[NR_BOOT_TASKS] */
+
+/* Tasks not yet reaped, but for the idle ones */
+static int nr_tasks;
+
+/* Live tasks by PID: the threads of a process are in the same bucket */
+static struct list_head pid_hash[PID_HASH_SIZE];
 
 #if 0
 struct task_struct *list_head_to_task_struct(struct list_head *l)
@@ -31,7 +41,8 @@ extern struct list_head blocked;
 
 // Free task structs
 struct list_head freequeue;
-// Ready queue
+// Destination token for update_process_state_rr(): READY tasks live in
+// their scheduling class
 struct list_head readyqueue;
 
 void init_stats(struct stats *s)
@@ -43,6 +54,56 @@ void init_stats(struct stats *s)
 	s->elapsed_total_ticks = get_ticks();
 	s->total_trans = 0;
 	s->remaining_ticks = get_ticks();
+	s->full_switches = 0;
+	s->same_mm_switches = 0;
+	s->deadline_misses = 0;
+	s->quantum = 0;
+}
+
+struct lat_hist sched_lat;
+
+void init_lat_hist(struct lat_hist *h)
+{
+  memset(h, 0, sizeof(struct lat_hist));
+}
+
+/* Bucket of a wait of 'cycles': the position of its highest bit */
+static int lat_bucket(unsigned long long cycles)
+{
+  unsigned long low = (unsigned long)cycles;
+  int b;
+
+  if (cycles >> 32)
+    return LAT_BUCKETS - 1;
+  if (low == 0)
+    return 0;
+  __asm__("bsrl %1, %0" : "=r" (b) : "rm" (low));
+  return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+static void lat_add(struct lat_hist *h, unsigned long long cycles)
+{
+  h->count++;
+  h->buckets[lat_bucket(cycles)]++;
+  if (cycles > h->max_cycles)
+    h->max_cycles = (cycles >> 32) ? 0xFFFFFFFF : (unsigned long)cycles;
+}
+
+/* Accounts the time 't', about to run, has been READY */
+static void lat_account(struct task_struct *t)
+{
+  unsigned long long now, cycles;
+
+  if (t->ready_tsc == 0)
+    return;
+
+  // The TSCs of two CPUs may be slightly apart after a steal
+  now = get_cycles();
+  cycles = now > t->ready_tsc ? now - t->ready_tsc : 0;
+  t->ready_tsc = 0;
+
+  lat_add(&t->lat, cycles);
+  lat_add(&sched_lat, cycles);
 }
 
 /* get_DIR - Returns the Page Directory address for task 't' */
@@ -54,33 +115,132 @@ page_table_entry * get_DIR (struct task_struct *t)
 /* get_PT - Returns the Page Table address for task 't' */
 page_table_entry * get_PT (struct task_struct *t) 
 {
-	return (page_table_entry *)(((unsigned int)(t->dir_pages_baseAddr->bits.pbase_addr))<<12);
+	return (page_table_entry *)frame_kaddr(t->dir_pages_baseAddr[ENTRY_DIR_PAGES].bits.pbase_addr);
 }
 
 
+/* Gives 't' an address space of its own, without user pages. Returns -1 if
+ * there is no memory for it */
 int allocate_DIR(struct task_struct *t) 
 {
-	int pos;
+	page_table_entry *dir = new_DIR();
 
-	pos = ((int)t-(int)task)/sizeof(union task_union);
+	if (dir == NULL)
+		return -1;
 
-	t->dir_pages_baseAddr = (page_table_entry*) &dir_pages[pos]; 
+	t->dir_pages_baseAddr = dir;
 
 	return 1;
 }
 
-void cpu_idle(void)
+/* Returns a frame for a new task, seen through the kernel window, or NULL
+ * if there is none or there are MAX_TASKS tasks already */
+union task_union *alloc_task_union(void)
 {
-	__asm__ __volatile__("sti": : :"memory");
+  int frame;
+
+  if (nr_tasks >= MAX_TASKS)
+    return NULL;
+
+  frame = alloc_frame();
+  if (frame < 0)
+    return NULL;
 
+  nr_tasks++;
+  return frame_to_kaddr(frame);
+}
+
+/* Frees the task 't', which is not running. The boot slots are not reused */
+void free_task_union(union task_union *t)
+{
+  nr_tasks--;
+  if ((unsigned int)t >= KMEM_START)
+    free_frame(kaddr_to_frame(t));
+}
+
+/**
+ * @brief Frees the dead tasks, and the address spaces they were the last
+ * users of
+ *
+ * A task joins the freequeue right before it leaves its CPU for the last
+ * time, with the kernel lock held: any task there but the running one is
+ * off its kernel stack. The last task of an address space still in the CR3
+ * of a CPU stays for a later call.
+ */
+void reap_tasks(void)
+{
+  struct list_head *pos, *n;
+  struct task_struct *t;
+
+  list_for_each_safe(pos, n, &freequeue) {
+    t = list_head_to_task_struct(pos);
+    if (t == current() || !put_DIR(get_DIR(t)))
+      continue;
+
+    list_del(pos);
+    free_task_union((union task_union *)t);
+  }
+}
+
+void hash_task(struct task_struct *t)
+{
+  list_add_tail(&t->pid_link, &pid_hash[t->PID & (PID_HASH_SIZE - 1)]);
+}
+
+void unhash_task(struct task_struct *t)
+{
+  list_del(&t->pid_link);
+}
+
+/* Returns the master thread of the live process 'pid', or NULL */
+struct task_struct *find_task_by_pid(int pid)
+{
+  struct list_head *pos;
+  struct task_struct *t;
+
+  list_for_each(pos, &pid_hash[pid & (PID_HASH_SIZE - 1)]) {
+    t = list_entry(pos, struct task_struct, pid_link);
+    if (t->PID == pid)
+      return t->master_thread;
+  }
+  return NULL;
+}
+
+#ifdef DYNTICKS
+/* The tick only stops while every online CPU is idle: CPU 0 keeps the clock
+ * and the kernel timers of the tasks running on the others */
+static int all_cpus_idle(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CPUS; i++)
+		if (cpus[i].online && !is_idle_task(cpus[i].curr))
+			return 0;
+	return 1;
+}
+#endif
+
+void cpu_idle(void)
+{
 	while(1)
 	{
-	;
+	/* A task woken up by an interrupt does not wait for the next tick,
+	 * and a READY task of another CPU is stolen */
+	if (nr_ready > 0)
+		sched_next_rr();
+#ifdef DYNTICKS
+	/* Only the bootstrap CPU has the PIT, and with it the kernel timers */
+	else if (smp_processor_id() == 0 && all_cpus_idle())
+		tick_nohz_idle_enter();
+#endif
+	/* The interrupts that wake us up take the kernel lock themselves */
+	kernel_exit();
+	/* 'sti' delays interrupts until after 'hlt': no wakeup is lost */
+	__asm__ __volatile__("sti; hlt; cli": : :"memory");
+	kernel_enter();
 	}
 }
 
-int remaining_quantum=0;
-
 int get_quantum(struct task_struct *t)
 {
   return t->total_quantum;
@@ -91,100 +251,354 @@ void set_quantum(struct task_struct *t, int new_quantum)
   t->total_quantum=new_quantum;
 }
 
+struct quantum_stats quantum_stats;
+
+/* Moving average giving the new sample a weight of 1/8 */
+static unsigned long ewma(unsigned long avg, unsigned long sample)
+{
+  if (avg == 0)
+    return sample;
+  return avg - avg / 8 + sample / 8;
+}
+
+static unsigned long long last_tick_tsc;
+
+/**
+ * @brief Measures the length of a clock tick in TSC cycles. Called by CPU 0
+ * when its tick starts a new period
+ * @param periodic 0 if the previous period was not a whole tick (tickless
+ *                 idle), only the timestamp is taken then
+ */
+void sample_tick_cycles(int periodic)
+{
+  unsigned long long now = get_cycles();
+
+  if (periodic && last_tick_tsc != 0 && now > last_tick_tsc &&
+      ((now - last_tick_tsc) >> 32) == 0)
+    quantum_stats.tick_cycles = ewma(quantum_stats.tick_cycles,
+                                     (unsigned long)(now - last_tick_tsc));
+  last_tick_tsc = now;
+}
+
+/* Charges the task switch that has just given the CPU to the running task */
+static void account_switch_cost(struct cpu *c)
+{
+  unsigned long long cycles;
+
+  if (c->switch_tsc == 0)
+    return;
+
+  cycles = get_cycles() - c->switch_tsc;
+  c->switch_tsc = 0;
+  // Another CPU's TSC after a steal, or a bogus one
+  if (cycles >> 32)
+    return;
+
+  quantum_stats.switch_cost = ewma(quantum_stats.switch_cost, (unsigned long)cycles);
+  if (cycles > quantum_stats.switch_cost_max)
+    quantum_stats.switch_cost_max = (unsigned long)cycles;
+  quantum_stats.switches_timed++;
+}
+
+/* Shortest quantum whose task switch costs at most QUANTUM_OVERHEAD per
+ * mille of it. 1 until the tick has been measured */
+static int min_quantum(void)
+{
+  unsigned long budget = quantum_stats.tick_cycles / 1000 * QUANTUM_OVERHEAD;
+  int q;
+
+  if (budget == 0)
+    return 1;
+
+  q = (quantum_stats.switch_cost + budget - 1) / budget;
+  return q > 0 ? q : 1;
+}
+
+/**
+ * @brief Sets the quantum of 't', about to run, from the tasks waiting on
+ * its CPU (see QUANTUM_LATENCY). The overhead bound wins when both cannot
+ * be met.
+ * @return The new quantum
+ */
+int sched_tune_quantum(struct task_struct *t)
+{
+  int waiting = cpus[t->cpu].nr_ready;
+  int q = QUANTUM_LATENCY / (waiting > 0 ? waiting : 1);
+  int floor = min_quantum();
+
+  quantum_stats.min_quantum = floor;
+  if (q < floor)
+    q = floor;
+
+  set_quantum(t, q);
+  return q;
+}
+
 struct task_struct *idle_task=NULL;
 
+struct sched_class *sched_classes[MAX_SCHED_CLASSES];
+int nr_sched_classes = 0;
+struct sched_class *default_sched_class = NULL;
+
+// Number of READY tasks in all the classes
+int nr_ready = 0;
+
+static int same_name(char *a, char *b)
+{
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
 /**
- * @brief Inserts a task into the ready queue based on priority
- * 
- * This function implements a priority-based insertion into the ready queue.
- * Tasks with higher priority are placed at the beginning of the queue.
- * The function ensures:
- * 1. Thread priority inheritance from master thread
- * 2. Proper state transitions
- * 3. Accurate statistics tracking
- * 
- * @param t Pointer to the task structure to be inserted
+ * @brief Adds a scheduling class after the already registered ones
+ * @return 0 on success, -ENOMEM if the class table is full
  */
-void insert_ready_ordered(struct task_struct *t) {
-    struct list_head *pos;
-    struct task_struct *current_pos;
-    
-    // Validate task pointer
-    if (!t) 
-      return;
-    
-    // Ensure thread priority matches master thread
-    if (t->master_thread != t) {
-        t->priority = t->master_thread->priority;
-    }
-    
-    // Fast path: empty queue
-    if (list_empty(&readyqueue)) {
-        list_add_tail(&t->list, &readyqueue);
-        t->state = ST_READY;
-        update_stats(&t->p_stats.system_ticks, &t->p_stats.elapsed_total_ticks);
-        return;
-    }
-    
-    // Find insertion point based on priority
-    list_for_each(pos, &readyqueue) {
-        current_pos = list_head_to_task_struct(pos);
-        
-        // Insert before first task with lower priority
-        if (t->priority > current_pos->priority) {
-            list_add(&t->list, pos);
-            t->state = ST_READY;
-            update_stats(&t->p_stats.system_ticks, &t->p_stats.elapsed_total_ticks);
-            
-            // ! If the inserted task has higher priority than current, force reschedule
-            if (t->priority > current()->priority) {
-                force_task_switch();
-            }
-            return;
-        }
-    }
-    
-    // If we get here, add at the end (lowest priority)
-    list_add_tail(&t->list, &readyqueue);
-    t->state = ST_READY;
-    update_stats(&t->p_stats.system_ticks, &t->p_stats.elapsed_total_ticks);
+int register_sched_class(struct sched_class *c)
+{
+  int i;
+
+  if (nr_sched_classes >= MAX_SCHED_CLASSES)
+    return -ENOMEM;
+
+  c->rank = nr_sched_classes;
+  for (i = 0; i < MAX_CPUS; i++)
+    c->nr_running[i] = 0;
+  if (c->init)
+    c->init();
+
+  sched_classes[nr_sched_classes++] = c;
+  return 0;
 }
 
-void update_sched_data_rr(void)
+/* Returns the registered class called 'name', or NULL */
+struct sched_class *find_sched_class(char *name)
 {
-  remaining_quantum--;
+  int i;
+
+  for (i = 0; i < nr_sched_classes; i++)
+    if (same_name(sched_classes[i]->name, name))
+      return sched_classes[i];
+
+  return NULL;
 }
 
-int needs_sched_rr(void)
+/**
+ * @brief Makes a new or preempted task READY in its scheduling class
+ * @param t Task to enqueue. The idle task is never enqueued.
+ */
+void sched_enqueue(struct task_struct *t)
 {
-  // Check if current quantum is over
-  if (remaining_quantum==0) {
-    if (!list_empty(&readyqueue)) return 1;
-    remaining_quantum=get_quantum(current());
-    return 0;
+  if (is_idle_task(t))
+    return;
+
+  t->sched_class->enqueue(t);
+  t->sched_class->nr_running[t->cpu]++;
+  cpus[t->cpu].nr_ready++;
+  nr_ready++;
+
+  t->state = ST_READY;
+  t->ready_tsc = get_cycles();
+  update_stats(&t->p_stats.system_ticks, &t->p_stats.elapsed_total_ticks);
+}
+
+/**
+ * @brief Chooses the CPU whose queues get a task that becomes READY
+ *
+ * The least loaded online CPU, counting its READY tasks plus the running
+ * one unless it is idle. The CPU the task last ran on wins the ties, its
+ * caches may still hold the task.
+ */
+static int select_task_cpu(struct task_struct *t)
+{
+  int best = t->cpu, best_load = -1;
+  int i, load;
+
+  if (!cpus[best].online)
+    best = smp_processor_id();
+
+  for (i = 0; i < MAX_CPUS; i++) {
+    if (!cpus[i].online)
+      continue;
+
+    load = cpus[i].nr_ready + (is_idle_task(cpus[i].curr) ? 0 : 1);
+    if (best_load < 0 || load < best_load || (load == best_load && i == t->cpu)) {
+      best = i;
+      best_load = load;
+    }
   }
+  return best;
+}
 
-  // Check if there's a higher priority thread in ready queue
-  if (!list_empty(&readyqueue)) {
-    struct task_struct *next_task = list_head_to_task_struct(list_first(&readyqueue));
-    if (next_task->priority > current()->priority) {
-      return 1;
+/**
+ * @brief Makes a task that was BLOCKED (or has just been created) READY
+ *
+ * The task may be queued on another CPU. That CPU is interrupted if it is
+ * idle or if the task should preempt the one it runs.
+ *
+ * @return 1 if 't' should preempt the task running on this CPU
+ */
+int sched_wakeup(struct task_struct *t)
+{
+  struct task_struct *curr;
+  int preempt, cpu;
+
+  // Its class state (the fair vruntime) is relative to the CPU it left
+  cpu = select_task_cpu(t);
+  if (cpu != t->cpu && t->sched_class->migrate)
+    t->sched_class->migrate(t, cpu);
+  t->cpu = cpu;
+  curr = cpu_curr(t->cpu);
+
+  // The time since it left the CPU was spent blocked
+  update_stats(&t->p_stats.blocked_ticks, &t->p_stats.elapsed_total_ticks);
+
+  preempt = t->sched_class->wakeup(t);
+  t->sched_class->nr_running[t->cpu]++;
+  cpus[t->cpu].nr_ready++;
+  nr_ready++;
+
+  t->state = ST_READY;
+  t->ready_tsc = get_cycles();
+
+  if (is_idle_task(curr) || t->sched_class->rank < curr->sched_class->rank)
+    preempt = 1;
+  else
+    preempt = preempt && t->sched_class == curr->sched_class;
+
+  if (t->cpu == smp_processor_id())
+    return preempt;
+
+  if (preempt) {
+    cpus[t->cpu].need_resched = 1;
+    send_reschedule(t->cpu);
+  }
+  return 0;
+}
+
+/* Removes a READY task from its scheduling class */
+void sched_dequeue(struct task_struct *t)
+{
+  t->sched_class->dequeue(t);
+  t->sched_class->nr_running[t->cpu]--;
+  cpus[t->cpu].nr_ready--;
+  nr_ready--;
+}
+
+/**
+ * @brief Sets the priority 't' inherits through the semaphores it holds
+ * @param prio Inherited priority, 0 for none
+ */
+void sched_set_pi_priority(struct task_struct *t, int prio)
+{
+  int old_prio = task_prio(t);
+
+  t->pi_priority = prio;
+  if (t->state == ST_READY && task_prio(t) != old_prio &&
+      t->sched_class->prio_changed)
+    t->sched_class->prio_changed(t, old_prio);
+}
+
+/* Tells the class of 't', which is not READY, that it loses the task */
+void sched_leave(struct task_struct *t)
+{
+  if (t->sched_class->leave)
+    t->sched_class->leave(t);
+}
+
+/* Asks the classes, in order, for the next task queued on 'cpu' */
+static struct task_struct *pick_cpu_task(int cpu)
+{
+  struct task_struct *t;
+  int i;
+
+  for (i = 0; i < nr_sched_classes; i++) {
+    if (sched_classes[i]->nr_running[cpu] == 0)
+      continue;
+
+    t = sched_classes[i]->pick_next(cpu);
+    if (t != NULL) {
+      sched_classes[i]->nr_running[cpu]--;
+      cpus[cpu].nr_ready--;
+      nr_ready--;
+      return t;
     }
   }
+  return NULL;
+}
+
+/**
+ * @brief Takes a READY task from the busiest CPU for 'cpu', which has none
+ * @return The stolen task, or NULL if no CPU has READY tasks
+ */
+static struct task_struct *steal_task(int cpu)
+{
+  struct task_struct *t;
+  int i, victim = -1;
+
+  for (i = 0; i < MAX_CPUS; i++)
+    if (i != cpu && cpus[i].nr_ready > 0 &&
+        (victim < 0 || cpus[i].nr_ready > cpus[victim].nr_ready))
+      victim = i;
+
+  if (victim < 0)
+    return NULL;
+
+  t = pick_cpu_task(victim);
+  if (t == NULL)
+    return NULL;
+
+  if (t->sched_class->migrate)
+    t->sched_class->migrate(t, cpu);
+  t->cpu = cpu;
+  cpus[cpu].nr_stolen++;
+  return t;
+}
+
+/* Next task for 'cpu': its own READY tasks first, then a stolen one. NULL
+ * if none is READY */
+static struct task_struct *pick_next_task(int cpu)
+{
+  struct task_struct *t = pick_cpu_task(cpu);
+
+  if (t == NULL && nr_ready > 0)
+    t = steal_task(cpu);
+  return t;
+}
+
+/* Returns 1 if a class with precedence over 'c' has READY tasks on 'cpu' */
+static int higher_class_ready(struct sched_class *c, int cpu)
+{
+  int i;
+
+  for (i = 0; i < c->rank; i++)
+    if (sched_classes[i]->nr_running[cpu] > 0)
+      return 1;
 
   return 0;
 }
+
 void update_process_state_rr(struct task_struct *t, struct list_head *dst_queue)
 {
+  enum state_t prev = t->state;
+
   // Remove from current queue if not running
-  if (t->state != ST_RUN) {
+  if (prev == ST_READY) {
+    sched_dequeue(t);
+  }
+  else if (prev != ST_RUN) {
     list_del(&t->list);
   }
-  
+
   if (dst_queue != NULL) {
     if (dst_queue == &readyqueue) {
-      // Insert into ready queue based on priority
-      insert_ready_ordered(t);
+      // A wakeup preempts the running task from the next schedule()
+      if (prev == ST_BLOCKED)
+        sched_wakeup(t);
+      else
+        sched_enqueue(t);
     }
     else {
       // Blocked queue
@@ -198,67 +612,154 @@ void update_process_state_rr(struct task_struct *t, struct list_head *dst_queue)
   }
 }
 
-void sched_next_rr(void)
+/* Gives 'cpu' (this one) to 't', no longer queued, for 'quantum' ticks */
+static void switch_to_task(int cpu, struct task_struct *t, int quantum)
 {
-  struct list_head *e;
-  struct task_struct *t;
-
-  if (!list_empty(&readyqueue)) {
-    // Get the highest priority task (first in queue)
-    e = list_first(&readyqueue);
-    list_del(e);
-    t = list_head_to_task_struct(e);
-  }
-  else {
-    t = idle_task;
-  }
-
   // Update current task stats before switching
   update_stats(&current()->p_stats.system_ticks, &current()->p_stats.elapsed_total_ticks);
 
   // Set new task as running
   t->state = ST_RUN;
-  remaining_quantum = get_quantum(t);
+  cpus[cpu].curr = t;
+  cpus[cpu].need_resched = 0;
+  cpus[cpu].remaining_quantum = quantum;
 
   // Update new task stats
   update_stats(&t->p_stats.ready_ticks, &t->p_stats.elapsed_total_ticks);
   t->p_stats.total_trans++;
+  lat_account(t);
 
+  cpus[cpu].switch_tsc = get_cycles();
   task_switch((union task_union*)t);
+
+  // Running again, maybe on another CPU
+  account_switch_cost(this_cpu());
+
+  // The task this CPU left may be dead
+  reap_tasks();
+}
+
+void sched_next_rr(void)
+{
+  struct task_struct *t;
+  int cpu = smp_processor_id();
+
+#ifdef DYNTICKS
+  // Any CPU leaving idle restarts the tick, under the kernel lock, before
+  // its task can read zeos_ticks or arm a timer
+  if (is_idle_task(current()) && (cpu == 0 || nr_ready > 0))
+    tick_nohz_idle_exit();
+#endif
+
+  t = pick_next_task(cpu);
+  if (t == NULL) {
+    t = cpus[cpu].idle;
+  }
+  else
+    sched_tune_quantum(t);
+
+  switch_to_task(cpu, t, get_quantum(t));
+}
+
+unsigned long nr_directed_yields;
+
+/**
+ * @brief Directed yield: the running task hands this CPU, and what is left
+ * of its quantum, straight to 't' without going through the queues
+ *
+ * The running task stays READY. 't' is taken from the queues of whatever
+ * CPU holds it.
+ *
+ * @return 0 once the caller runs again, -EINVAL if 't' is not READY
+ */
+int sched_yield_to(struct task_struct *t)
+{
+  struct task_struct *curr = current();
+  int cpu = smp_processor_id();
+  int quantum = cpus[cpu].remaining_quantum;
+
+  if (t == curr || t->state != ST_READY)
+    return -EINVAL;
+
+  sched_dequeue(t);
+  if (t->cpu != cpu) {
+    if (t->sched_class->migrate)
+      t->sched_class->migrate(t, cpu);
+    t->cpu = cpu;
+  }
+
+  update_process_state_rr(curr, &readyqueue);
+  nr_directed_yields++;
+
+  switch_to_task(cpu, t, quantum > 0 ? quantum : 1);
+  return 0;
 }
 
 void schedule()
 {
-  update_sched_data_rr();
-  if (needs_sched_rr())
+  struct task_struct *t = current();
+  int resched;
+
+  if (is_idle_task(t))
+    resched = nr_ready > 0;
+  else {
+    resched = t->sched_class->tick(t);
+    if (resched == SCHED_THROTTLE) {
+      // The class wakes it up later
+      update_process_state_rr(t, &blocked);
+      sched_next_rr();
+      return;
+    }
+    resched = resched ||
+              higher_class_ready(t->sched_class, t->cpu) ||
+              this_cpu()->need_resched;
+  }
+
+  if (resched)
   {
-    update_process_state_rr(current(), &readyqueue);
+    update_process_state_rr(t, &readyqueue);
     sched_next_rr();
   }
 }
 
-void init_idle (void)
+/**
+ * @brief Initializes the fields shared by the idle tasks of all the CPUs
+ * @param c Idle task, its kernel stack is set up by the caller
+ * @param cpu CPU it belongs to
+ */
+void init_idle_task(struct task_struct *c, int cpu)
 {
-  struct list_head *l = list_first(&freequeue);
-  list_del(l);
-  struct task_struct *c = list_head_to_task_struct(l);
-  union task_union *uc = (union task_union*)c;
-
   c->PID=0;
 
   c->total_quantum=DEFAULT_QUANTUM;
+  c->state=ST_RUN;
 
   init_stats(&c->p_stats);
+  init_lat_hist(&c->lat);
+  c->ready_tsc = 0;
 
   c->screen_page = (void*)-1; // No screen page
   c->priority = DEFAULT_PRIORITY;
+  c->sched_class = default_sched_class;
   c->TID = 1;
   c->master_thread = c;
+  c->cpu = cpu;
+  c->exiting = 0;
   
   INIT_LIST_HEAD(&(c->threads));
   INIT_LIST_HEAD(&(c->threads_list));
 
-  allocate_DIR(c);
+  cpus[cpu].idle = c;
+}
+
+void init_idle (void)
+{
+  union task_union *uc = &task[0];
+  struct task_struct *c = &uc->task;
+
+  init_idle_task(c, 0);
+
+  c->dir_pages_baseAddr = dir_pages;
 
   uc->stack[KERNEL_STACK_SIZE-1]=(unsigned long)&cpu_idle; /* Return address */
   uc->stack[KERNEL_STACK_SIZE-2]=0; /* register ebp */
@@ -272,10 +773,8 @@ void setMSR(unsigned long msr_number, unsigned long high, unsigned long low);
 
 void init_task1(void)
 {
-  struct list_head *l = list_first(&freequeue);
-  list_del(l);
-  struct task_struct *c = list_head_to_task_struct(l);
-  union task_union *uc = (union task_union*)c;
+  union task_union *uc = &task[1];
+  struct task_struct *c = &uc->task;
 
   c->PID=1;
 
@@ -283,49 +782,54 @@ void init_task1(void)
 
   c->state=ST_RUN;
 
-  c->pause_time = 0; // No pause time
+  init_timer(&c->pause_timer); // No pause time
+  init_timer(&c->edf_timer);
   c->screen_page = (void*)-1; // No screen page
   c->priority = DEFAULT_PRIORITY;
+  c->sched_class = default_sched_class;
+  c->mlfq_level = 0;
+  c->mlfq_used = 0;
   c->TID = 1;
   c->master_thread = c;
   c->next_sem_id = 0;
+  c->pi_priority = 0;
+  c->pi_blocked_on = NULL;
+  c->pi_wait_start = 0;
   c->user_stack_ptr = NULL;
+  c->heap_brk = PAG_LOG_INIT_HEAP << 12;
   c->thread_count = 1;
+  c->cpu = 0;
+  c->exiting = 0;
 
   INIT_LIST_HEAD(&(c->threads));
   INIT_LIST_HEAD(&(c->threads_list));
 
-  remaining_quantum=c->total_quantum;
+  cpus[0].curr = c;
+  cpus[0].remaining_quantum = c->total_quantum;
 
   init_stats(&c->p_stats);
+  init_lat_hist(&c->lat);
+  c->ready_tsc = 0;
 
   allocate_DIR(c);
+  nr_tasks = 1;
+  hash_task(c);
 
   set_user_pages(c);
 
-  tss.esp0=(DWord)&(uc->stack[KERNEL_STACK_SIZE]);
+  cpus[0].tss->esp0=(DWord)&(uc->stack[KERNEL_STACK_SIZE]);
   setMSR(0x175, 0, (unsigned long)&(uc->stack[KERNEL_STACK_SIZE]));
 
   set_cr3(c->dir_pages_baseAddr);
 
   // ! Initialize the semaphore array
-  c->semaphores = &(semaphores[0]); // First semaphore in the array
-  c->semaphores->owner = c->TID;
-  
-  // ! Initialize the semaphore structure
-  init_sem_array();
+  c->semaphores = alloc_sem_array(c->TID);
 
-}
-
-void init_sem_array() {
-  for (int i = 0; i < NR_TASKS; i++) {
-    semaphores[i].owner = -1;
-    for (int j = 0; j < MAX_SEMAPHORES; j++) {
-      semaphores[i].sem[j].count = -1;
-      semaphores[i].sem[j].TID = -1;
-      INIT_LIST_HEAD(&(semaphores[i].sem[j].blocked));
-    }
-  }
+  // Its areas: the heap zone is reserved whole, used up to the break
+  INIT_LIST_HEAD(&c->vmas);
+  vma_create(c, PAG_LOG_INIT_CODE, PAG_LOG_INIT_CODE + NUM_PAG_CODE, VMA_CODE, VM_READ);
+  vma_create(c, PAG_LOG_INIT_DATA, PAG_LOG_INIT_DATA + NUM_PAG_DATA, VMA_DATA, VM_READ | VM_WRITE);
+  vma_create(c, PAG_LOG_INIT_HEAP, PAG_LOG_INIT_HEAP + NUM_PAG_HEAP, VMA_HEAP, VM_READ | VM_WRITE);
 }
 
 void init_freequeue()
@@ -334,12 +838,8 @@ void init_freequeue()
 
   INIT_LIST_HEAD(&freequeue);
 
-  /* Insert all task structs in the freequeue */
-  for (i=0; i<NR_TASKS; i++)
-  {
-    task[i].task.PID=-1;
-    list_add_tail(&(task[i].task.list), &freequeue);
-  }
+  for (i = 0; i < PID_HASH_SIZE; i++)
+    INIT_LIST_HEAD(&pid_hash[i]);
 }
 
 extern char keyboard_buffer[128];
@@ -347,7 +847,21 @@ void init_sched()
 {
   init_freequeue(); 
   INIT_LIST_HEAD(&readyqueue);
+
+  // ! Scheduling classes, from the highest to the lowest precedence
+  register_sched_class(&edf_sched_class);
+  register_sched_class(&rr_sched_class);
+  register_sched_class(&mlfq_sched_class);
+  register_sched_class(&fair_sched_class);
+
+  default_sched_class = find_sched_class(SCHED_DEFAULT);
+  // EDF needs the parameters of every task, it cannot be the default
+  if (default_sched_class == NULL || default_sched_class == &edf_sched_class) {
+    printk("Unknown scheduling class, using rr\n");
+    default_sched_class = &rr_sched_class;
+  }
   INIT_LIST_HEAD(&blocked);
+  init_timers();
 
   // ! Initialize the keyboard buffer
   for (int i = 0; i < 128; i++) 
@@ -355,6 +869,9 @@ void init_sched()
 
   // ! Initialize the semaphore array
   init_sem_array();
+  init_futex();
+  init_shm();
+  init_vma();
 }
 
 struct task_struct* current()
@@ -369,17 +886,36 @@ struct task_struct* list_head_to_task_struct(struct list_head *l)
   return (struct task_struct*)((int)l&0xfffff000);
 }
 
+struct switch_stats switch_stats;
+
 /* Do the magic of a task switch */
 void inner_task_switch(union task_union *new)
 {
   page_table_entry *new_DIR = get_DIR(&new->task);
 
-  /* Update TSS and MSR to make it point to the new stack */
-  tss.esp0=(int)&(new->stack[KERNEL_STACK_SIZE]);
+  struct cpu *c = this_cpu();
+
+  /* Update TSS and MSR to make it point to the new stack (every thread has
+   * its own kernel stack, so this is needed even in the same process) */
+  c->tss->esp0=(int)&(new->stack[KERNEL_STACK_SIZE]);
   setMSR(0x175, 0, (unsigned long)&(new->stack[KERNEL_STACK_SIZE]));
 
-  /* TLB flush. New address space */
-  set_cr3(new_DIR);
+  if (new_DIR == c->active_dir) {
+    /* Threads of the same process: same address space, keep the TLB */
+    switch_stats.same_mm++;
+    new->task.p_stats.same_mm_switches++;
+  }
+  else if (is_idle_task(&new->task) && c->active_dir != NULL) {
+    /* Idle only runs kernel code, mapped in every directory. A directory
+     * about to be freed is not kept, though (active_dir NULL) */
+    switch_stats.lazy_idle++;
+  }
+  else {
+    /* TLB flush. New address space */
+    set_cr3(new_DIR);
+    switch_stats.full++;
+    new->task.p_stats.full_switches++;
+  }
 
   switch_stack(&current()->register_esp, new->task.register_esp);
 }
@@ -0,0 +1,243 @@
+/*
+ * sched_edf.c - Earliest deadline first real-time scheduling class
+ *
+ * A task joins the class with edf_set_params() if the bandwidth
+ * (budget/period) of all the EDF tasks stays under EDF_MAX_BW. A job of
+ * the task is released every 'period' ticks; it may run for 'budget' ticks
+ * and should end, with edf_wait_next_period(), 'deadline' ticks after its
+ * release. The READY job with the earliest absolute deadline runs first. A
+ * job that uses up its budget is throttled (blocked) until the next
+ * release, so an overrunning task cannot steal the CPU time reserved to
+ * the others. READY tasks are kept in a list sorted by deadline, one per
+ * CPU (it never holds more than MAX_TASKS entries).
+ *
+ * The admission test is done against a single CPU: the EDF tasks queued on
+ * any CPU are a subset of the admitted set, so they are schedulable there.
+ */
+
+#include <sched.h>
+#include <errno.h>
+
+extern int zeos_ticks;
+extern struct list_head blocked;
+
+static struct list_head edf_queue[MAX_CPUS];
+
+struct edf_stats edf_stats;
+
+/* Wrap-around safe 'a < b' for tick counts */
+#define time_before(a, b) ((long)((a) - (b)) < 0)
+
+/* Bandwidth of a reservation, rounded up so admission stays on the safe side */
+static int edf_bw(int budget, int period)
+{
+  return (budget * EDF_BW_ONE + period - 1) / period;
+}
+
+static void edf_miss(struct task_struct *t)
+{
+  t->p_stats.deadline_misses++;
+  edf_stats.misses++;
+}
+
+/* Starts the job of 't' released at 'release', with the whole budget */
+static void start_job(struct task_struct *t, unsigned long release)
+{
+  t->edf_release = release;
+  t->edf_deadline = release + t->edf_rel_deadline;
+  t->edf_runtime = t->edf_budget;
+}
+
+/* Last release of 't' not after 'now' */
+static unsigned long last_release(struct task_struct *t, unsigned long now)
+{
+  return t->edf_release +
+         (now - t->edf_release) / t->edf_period * t->edf_period;
+}
+
+/* Timer of a task blocked until its next release: 'data' is the task */
+static void release_timeout(unsigned long data)
+{
+  struct task_struct *t = (struct task_struct *)data;
+
+  start_job(t, t->edf_timer.expires);
+  update_process_state_rr(t, &readyqueue);
+}
+
+static void arm_release(struct task_struct *t, unsigned long release)
+{
+  t->edf_timer.expires = release;
+  t->edf_timer.function = release_timeout;
+  t->edf_timer.data = (unsigned long)t;
+  add_timer(&t->edf_timer);
+}
+
+static void edf_init(void)
+{
+  int cpu;
+
+  for (cpu = 0; cpu < MAX_CPUS; cpu++)
+    INIT_LIST_HEAD(&edf_queue[cpu]);
+}
+
+/* Inserts 't' after the tasks whose deadline is not later: FIFO among equals */
+static void edf_enqueue(struct task_struct *t)
+{
+  struct list_head *head = &edf_queue[t->cpu], *pos;
+
+  list_for_each(pos, head)
+    if (time_before(t->edf_deadline, list_head_to_task_struct(pos)->edf_deadline))
+      break;
+  list_add_tail(&t->list, pos);
+}
+
+static void edf_dequeue(struct task_struct *t)
+{
+  list_del(&t->list);
+}
+
+static struct task_struct *edf_pick_next(int cpu)
+{
+  struct task_struct *t;
+
+  if (list_empty(&edf_queue[cpu]))
+    return NULL;
+
+  t = list_head_to_task_struct(list_first(&edf_queue[cpu]));
+  list_del(&t->list);
+  return t;
+}
+
+/* Charges the tick to the budget of the job, and preempts it for an earlier
+ * deadline */
+static int edf_tick(struct task_struct *t)
+{
+  struct list_head *head = &edf_queue[t->cpu];
+  unsigned long now = zeos_ticks;
+
+  // Still running when the next job is released: the late job is dropped
+  if (!time_before(now, t->edf_release + t->edf_period)) {
+    edf_miss(t);
+    start_job(t, last_release(t, now));
+  }
+
+  if (--t->edf_runtime <= 0) {
+    // It cannot run again before the next release, past its deadline
+    edf_stats.throttles++;
+    edf_miss(t);
+    arm_release(t, t->edf_release + t->edf_period);
+    return SCHED_THROTTLE;
+  }
+
+  return !list_empty(head) &&
+         time_before(list_head_to_task_struct(list_first(head))->edf_deadline,
+                     t->edf_deadline);
+}
+
+static int edf_wakeup(struct task_struct *t)
+{
+  struct task_struct *curr = cpu_curr(t->cpu);
+
+  edf_enqueue(t);
+
+  if (curr->sched_class != &edf_sched_class)
+    return 0;
+  return time_before(t->edf_deadline, curr->edf_deadline);
+}
+
+/* Gives back the bandwidth of 't' */
+static void edf_leave(struct task_struct *t)
+{
+  del_timer(&t->edf_timer);
+  edf_stats.bandwidth -= edf_bw(t->edf_budget, t->edf_period);
+}
+
+struct sched_class edf_sched_class = {
+  .name      = "edf",
+  .init      = edf_init,
+  .pick_next = edf_pick_next,
+  .enqueue   = edf_enqueue,
+  .dequeue   = edf_dequeue,
+  .tick      = edf_tick,
+  .wakeup    = edf_wakeup,
+  .leave     = edf_leave,
+};
+
+/**
+ * @brief Makes the running task 't' periodic, or changes its reservation
+ *
+ * The first job is released now. With 'period' 0 the task goes back to the
+ * class it had before.
+ *
+ * @param period Ticks between releases
+ * @param budget CPU ticks granted to every job
+ * @param deadline Ticks after the release the job should be done by, from
+ *                 'budget' up to 'period'
+ * @return 0 on success, -EINVAL for wrong parameters, -EBUSY if the
+ *         reservation does not pass the admission test
+ */
+int edf_set_params(struct task_struct *t, int period, int budget, int deadline)
+{
+  int bw, old_bw = 0;
+
+  if (period == 0) {
+    if (t->sched_class == &edf_sched_class) {
+      sched_leave(t);
+      t->sched_class = t->edf_prev_class;
+    }
+    return 0;
+  }
+
+  if (period < 0 || budget <= 0 || deadline < budget || deadline > period)
+    return -EINVAL;
+
+  bw = edf_bw(budget, period);
+  if (t->sched_class == &edf_sched_class)
+    old_bw = edf_bw(t->edf_budget, t->edf_period);
+  if (edf_stats.bandwidth - old_bw + bw > EDF_MAX_BW)
+    return -EBUSY;
+  edf_stats.bandwidth += bw - old_bw;
+
+  if (t->sched_class != &edf_sched_class) {
+    t->edf_prev_class = t->sched_class;
+    t->sched_class = &edf_sched_class;
+    init_timer(&t->edf_timer);
+  }
+  t->edf_period = period;
+  t->edf_budget = budget;
+  t->edf_rel_deadline = deadline;
+  start_job(t, zeos_ticks);
+  return 0;
+}
+
+/**
+ * @brief Ends the current job of the running task 't' and blocks it until
+ * the release of the next one
+ *
+ * If that release has already passed, the latest job starts right away.
+ *
+ * @return Deadlines missed by 't' so far, or -EINVAL if it is not periodic
+ */
+int edf_wait_next_period(struct task_struct *t)
+{
+  unsigned long now = zeos_ticks;
+  unsigned long next;
+
+  if (t->sched_class != &edf_sched_class)
+    return -EINVAL;
+
+  if (time_before(t->edf_deadline, now))
+    edf_miss(t);
+
+  next = t->edf_release + t->edf_period;
+  if (!time_before(now, next)) {
+    start_job(t, last_release(t, now));
+    return t->p_stats.deadline_misses;
+  }
+
+  arm_release(t, next);
+  update_process_state_rr(t, &blocked);
+  sched_next_rr();
+
+  return t->p_stats.deadline_misses;
+}
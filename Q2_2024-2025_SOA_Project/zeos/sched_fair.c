@@ -0,0 +1,201 @@
+/*
+ * sched_fair.c - Fair share scheduling class (virtual runtime)
+ *
+ * Every task accumulates the CPU time measured by update_stats() (p_stats
+ * user + system ticks) scaled by the inverse of its weight, which is its
+ * priority. The READY task with the smallest virtual runtime runs next, so
+ * the CPU is shared in proportion to the priorities instead of the highest
+ * priority starving the rest. READY tasks are kept in a binary min-heap
+ * keyed on vruntime, one per CPU.
+ */
+
+#include <sched.h>
+#include <utils.h>
+
+struct fair_rq {
+  struct task_struct *heap[MAX_TASKS];
+  int nr;
+  unsigned long long min_vruntime; /* Never decreases */
+};
+
+static struct fair_rq fair_rq[MAX_CPUS];
+
+/* CPU time of 't', including the part not yet accounted by update_stats() */
+static unsigned long exec_ticks(struct task_struct *t)
+{
+  return t->p_stats.user_ticks + t->p_stats.system_ticks +
+         (get_ticks() - t->p_stats.elapsed_total_ticks);
+}
+
+/* Charges the CPU time run since the last call to the vruntime of 't' */
+static void update_curr(struct task_struct *t)
+{
+  unsigned long now = exec_ticks(t);
+  unsigned long delta = now - t->fair_exec_mark;
+  unsigned long inv_weight;
+
+  t->fair_exec_mark = now;
+
+  // vruntime advances DEFAULT_PRIORITY/priority times the CPU time (16.16)
+  inv_weight = (DEFAULT_PRIORITY << 16) / (task_prio(t) > 0 ? task_prio(t) : 1);
+  t->vruntime += ((unsigned long long)delta * inv_weight) >> 16;
+}
+
+static int heap_less(struct fair_rq *rq, int a, int b)
+{
+  return rq->heap[a]->vruntime < rq->heap[b]->vruntime;
+}
+
+static void heap_swap(struct fair_rq *rq, int a, int b)
+{
+  struct task_struct *t = rq->heap[a];
+
+  rq->heap[a] = rq->heap[b];
+  rq->heap[b] = t;
+  rq->heap[a]->fair_heap_idx = a;
+  rq->heap[b]->fair_heap_idx = b;
+}
+
+static void heap_up(struct fair_rq *rq, int i)
+{
+  while (i > 0 && heap_less(rq, i, (i - 1) / 2)) {
+    heap_swap(rq, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void heap_down(struct fair_rq *rq, int i)
+{
+  int min, l, r;
+
+  for (;;) {
+    min = i;
+    l = 2 * i + 1;
+    r = l + 1;
+    if (l < rq->nr && heap_less(rq, l, min)) min = l;
+    if (r < rq->nr && heap_less(rq, r, min)) min = r;
+    if (min == i) return;
+    heap_swap(rq, i, min);
+    i = min;
+  }
+}
+
+static void heap_insert(struct fair_rq *rq, struct task_struct *t)
+{
+  t->fair_heap_idx = rq->nr;
+  rq->heap[rq->nr++] = t;
+  heap_up(rq, t->fair_heap_idx);
+}
+
+/* min_vruntime follows the smallest vruntime among the READY tasks and 'curr' */
+static void update_min_vruntime(struct fair_rq *rq, struct task_struct *curr)
+{
+  unsigned long long v;
+
+  if (rq->nr > 0) {
+    v = rq->heap[0]->vruntime;
+    if (curr != NULL && curr->vruntime < v)
+      v = curr->vruntime;
+  }
+  else if (curr != NULL)
+    v = curr->vruntime;
+  else
+    return;
+
+  if (v > rq->min_vruntime)
+    rq->min_vruntime = v;
+}
+
+static void fair_init(void)
+{
+  int cpu;
+
+  for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+    fair_rq[cpu].nr = 0;
+    fair_rq[cpu].min_vruntime = 0;
+  }
+}
+
+static void fair_enqueue(struct task_struct *t)
+{
+  update_curr(t);
+  heap_insert(&fair_rq[t->cpu], t);
+}
+
+static void fair_dequeue(struct task_struct *t)
+{
+  struct fair_rq *rq = &fair_rq[t->cpu];
+  int i = t->fair_heap_idx;
+
+  rq->nr--;
+  if (i != rq->nr) {
+    heap_swap(rq, i, rq->nr);
+    heap_up(rq, i);
+    heap_down(rq, i);
+  }
+}
+
+static struct task_struct *fair_pick_next(int cpu)
+{
+  struct fair_rq *rq = &fair_rq[cpu];
+  struct task_struct *t;
+
+  if (rq->nr == 0)
+    return NULL;
+
+  t = rq->heap[0];
+  fair_dequeue(t);
+  update_min_vruntime(rq, t);
+  return t;
+}
+
+/* Preempts the running task as soon as a READY one has run less */
+static int fair_tick(struct task_struct *t)
+{
+  struct fair_rq *rq = &fair_rq[t->cpu];
+
+  update_curr(t);
+  update_min_vruntime(rq, t);
+
+  return rq->nr > 0 && rq->heap[0]->vruntime < t->vruntime;
+}
+
+static int fair_wakeup(struct task_struct *t)
+{
+  struct fair_rq *rq = &fair_rq[t->cpu];
+  struct task_struct *curr = cpu_curr(t->cpu);
+
+  // Time spent blocked is not CPU time
+  t->fair_exec_mark = exec_ticks(t);
+
+  // A sleeper does not get back more than FAIR_SLEEPER_BONUS of credit
+  if (t->vruntime + FAIR_SLEEPER_BONUS < rq->min_vruntime)
+    t->vruntime = rq->min_vruntime - FAIR_SLEEPER_BONUS;
+
+  heap_insert(rq, t);
+
+  if (curr->sched_class != &fair_sched_class)
+    return 0;
+
+  update_curr(curr);
+  return t->vruntime < curr->vruntime;
+}
+
+/* Keeps the lag of a task moved to another CPU: its distance to
+ * min_vruntime is the same in the queue of the new CPU */
+static void fair_migrate(struct task_struct *t, int cpu)
+{
+  t->vruntime = t->vruntime - fair_rq[t->cpu].min_vruntime +
+                fair_rq[cpu].min_vruntime;
+}
+
+struct sched_class fair_sched_class = {
+  .name      = "fair",
+  .init      = fair_init,
+  .pick_next = fair_pick_next,
+  .enqueue   = fair_enqueue,
+  .dequeue   = fair_dequeue,
+  .tick      = fair_tick,
+  .wakeup    = fair_wakeup,
+  .migrate   = fair_migrate,
+};
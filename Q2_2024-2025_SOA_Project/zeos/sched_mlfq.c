@@ -0,0 +1,185 @@
+/*
+ * sched_mlfq.c - Multi-level feedback queue scheduling class
+ *
+ * Tasks start at level 0 and run in Round Robin inside their level. Using
+ * the whole slice of a level makes a CPU-bound task sink to the next one,
+ * where the slice is twice as long. A task that has spent more time
+ * blocked than running since it reached its level (p_stats accounting)
+ * climbs one level when it wakes up. The periodic boost moves everybody
+ * back to level 0 so that no task starves. Every CPU has its own set of
+ * levels; the boost covers all of them.
+ */
+
+#include <sched.h>
+#include <interrupt.h>
+
+extern int zeos_ticks;
+
+static struct list_head mlfq_queue[MAX_CPUS][MLFQ_LEVELS];
+static unsigned long mlfq_bitmap[MAX_CPUS]; /* Bit 'l' set while mlfq_queue[cpu][l] is not empty */
+static int mlfq_epoch;             /* Number of boosts done */
+static int mlfq_last_boost;        /* zeos_ticks of the last boost */
+
+struct mlfq_stats mlfq_stats;
+
+/* Index of the least significant bit set in 'w' (w != 0) */
+static inline int ffs_bit(unsigned long w)
+{
+  int bit;
+
+  __asm__ ("bsfl %1, %0" : "=r" (bit) : "rm" (w));
+  return bit;
+}
+
+static int mlfq_slice(struct task_struct *t)
+{
+  return get_quantum(t) << t->mlfq_level;
+}
+
+static unsigned long cpu_ticks(struct task_struct *t)
+{
+  return t->p_stats.user_ticks + t->p_stats.system_ticks;
+}
+
+/* Moves 't' to 'level' and restarts its accounting there */
+static void mlfq_set_level(struct task_struct *t, int level)
+{
+  t->mlfq_level = level;
+  t->mlfq_used = 0;
+  t->mlfq_cpu_mark = cpu_ticks(t);
+  t->mlfq_blocked_mark = t->p_stats.blocked_ticks;
+}
+
+static void mlfq_init(void)
+{
+  int cpu, i;
+
+  for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+    for (i = 0; i < MLFQ_LEVELS; i++)
+      INIT_LIST_HEAD(&mlfq_queue[cpu][i]);
+    mlfq_bitmap[cpu] = 0;
+  }
+  mlfq_epoch = 0;
+  mlfq_last_boost = 0;
+  mlfq_stats.demotions = 0;
+  mlfq_stats.promotions = 0;
+  mlfq_stats.boosts = 0;
+}
+
+static void mlfq_enqueue(struct task_struct *t)
+{
+  // A task blocked during a boost did not get it yet
+  if (t->mlfq_epoch != mlfq_epoch) {
+    t->mlfq_epoch = mlfq_epoch;
+    mlfq_set_level(t, 0);
+  }
+
+  list_add_tail(&t->list, &mlfq_queue[t->cpu][t->mlfq_level]);
+  mlfq_bitmap[t->cpu] |= 1UL << t->mlfq_level;
+}
+
+static void mlfq_dequeue(struct task_struct *t)
+{
+  list_del(&t->list);
+  if (list_empty(&mlfq_queue[t->cpu][t->mlfq_level]))
+    mlfq_bitmap[t->cpu] &= ~(1UL << t->mlfq_level);
+}
+
+static struct task_struct *mlfq_pick_next(int cpu)
+{
+  struct task_struct *t;
+
+  if (mlfq_bitmap[cpu] == 0)
+    return NULL;
+
+  t = list_head_to_task_struct(list_first(&mlfq_queue[cpu][ffs_bit(mlfq_bitmap[cpu])]));
+  mlfq_dequeue(t);
+  return t;
+}
+
+/* Moves every READY task of every CPU, and the running one, to level 0.
+ * Tasks running on the other CPUs get the boost when they are enqueued */
+static void mlfq_boost(struct task_struct *curr)
+{
+  struct list_head *pos, *tmp;
+  int cpu, level;
+
+  for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+    for (level = 1; level < MLFQ_LEVELS; level++) {
+      list_for_each_safe(pos, tmp, &mlfq_queue[cpu][level]) {
+        struct task_struct *t = list_head_to_task_struct(pos);
+
+        list_del(pos);
+        mlfq_set_level(t, 0);
+        t->mlfq_epoch = mlfq_epoch + 1;
+        list_add_tail(pos, &mlfq_queue[cpu][0]);
+      }
+    }
+    mlfq_bitmap[cpu] = list_empty(&mlfq_queue[cpu][0]) ? 0 : 1;
+  }
+
+  mlfq_set_level(curr, 0);
+  curr->mlfq_epoch = mlfq_epoch + 1;
+
+  mlfq_epoch++;
+  mlfq_last_boost = zeos_ticks;
+  mlfq_stats.boosts++;
+}
+
+static int mlfq_tick(struct task_struct *t)
+{
+  struct cpu *c = &cpus[t->cpu];
+
+  if (zeos_ticks - mlfq_last_boost >= MLFQ_BOOST_TICKS)
+    mlfq_boost(t);
+
+  t->mlfq_used++;
+  c->remaining_quantum = mlfq_slice(t) - t->mlfq_used;
+
+  if (c->remaining_quantum <= 0) {
+    // The whole slice was used: CPU-bound, sink one level
+    if (t->mlfq_level < MLFQ_LEVELS - 1) {
+      mlfq_set_level(t, t->mlfq_level + 1);
+      mlfq_stats.demotions++;
+    }
+    else
+      t->mlfq_used = 0;
+
+    if (c->nr_ready > 0) return 1;
+    c->remaining_quantum = mlfq_slice(t);
+    return 0;
+  }
+
+  // Check if there's a task in a higher level
+  return mlfq_bitmap[t->cpu] != 0 && ffs_bit(mlfq_bitmap[t->cpu]) < t->mlfq_level;
+}
+
+static int mlfq_wakeup(struct task_struct *t)
+{
+  unsigned long cpu = cpu_ticks(t) - t->mlfq_cpu_mark;
+  unsigned long blocked = t->p_stats.blocked_ticks - t->mlfq_blocked_mark;
+
+  // Mostly blocked since it reached this level: interactive, climb one
+  // level (or restart the slice at the top one)
+  if (t->mlfq_epoch == mlfq_epoch && blocked > cpu) {
+    if (t->mlfq_level > 0) {
+      mlfq_set_level(t, t->mlfq_level - 1);
+      mlfq_stats.promotions++;
+    }
+    else
+      mlfq_set_level(t, 0);
+  }
+
+  mlfq_enqueue(t);
+  return t->mlfq_level < cpu_curr(t->cpu)->mlfq_level;
+}
+
+struct sched_class mlfq_sched_class = {
+  .name      = "mlfq",
+  .init      = mlfq_init,
+  .pick_next = mlfq_pick_next,
+  .enqueue   = mlfq_enqueue,
+  .dequeue   = mlfq_dequeue,
+  .tick      = mlfq_tick,
+  .wakeup    = mlfq_wakeup,
+};
@@ -0,0 +1,198 @@
+/*
+ * sched_rr.c - Round Robin scheduling class with static priorities
+ */
+
+#include <sched.h>
+#include <interrupt.h>
+
+extern int zeos_ticks;
+
+// Run queue of every CPU
+struct runqueue runqueues[MAX_CPUS];
+
+/* Index of the most significant bit set in 'w' (w != 0) */
+static inline int fls_bit(unsigned long w)
+{
+  int bit;
+
+  __asm__ ("bsrl %1, %0" : "=r" (bit) : "rm" (w));
+  return bit;
+}
+
+static void init_runqueue(struct runqueue *rq)
+{
+  int i;
+
+  for (i = 0; i < RQ_LEVELS; i++)
+    INIT_LIST_HEAD(&rq->queue[i]);
+  for (i = 0; i < RQ_BITMAP_WORDS; i++)
+    rq->bitmap[i] = 0;
+  rq->summary = 0;
+  rq->nr_running = 0;
+  rq->nr_ops = 0;
+  rq->ops_per_sec = 0;
+  rq->ops_mark = 0;
+  rq->window_start = 0;
+}
+
+/**
+ * @brief Appends a task to the FIFO of its priority level in the run queue
+ * of t->cpu
+ *
+ * The caller is responsible for updating the state of the task.
+ *
+ * @param t Task to enqueue. Its priority must not change while it is
+ *          queued, except through rr_prio_changed().
+ */
+static void rq_enqueue(struct task_struct *t)
+{
+  struct runqueue *rq = &runqueues[t->cpu];
+  int prio = task_prio(t);
+
+  list_add_tail(&t->list, &rq->queue[prio]);
+  rq->bitmap[prio >> 5] |= 1UL << (prio & 31);
+  rq->summary |= 1UL << (prio >> 5);
+  rq->nr_running++;
+  rq->nr_ops++;
+}
+
+/**
+ * @brief Removes a READY task from the run queue of t->cpu
+ * @param t Task to dequeue
+ * @param prio Priority level it was queued at
+ */
+static void rq_dequeue_prio(struct task_struct *t, int prio)
+{
+  struct runqueue *rq = &runqueues[t->cpu];
+
+  list_del(&t->list);
+  if (list_empty(&rq->queue[prio])) {
+    rq->bitmap[prio >> 5] &= ~(1UL << (prio & 31));
+    if (rq->bitmap[prio >> 5] == 0)
+      rq->summary &= ~(1UL << (prio >> 5));
+  }
+  rq->nr_running--;
+  rq->nr_ops++;
+}
+
+static void rq_dequeue(struct task_struct *t)
+{
+  rq_dequeue_prio(t, task_prio(t));
+}
+
+/**
+ * @brief Returns the highest priority with READY tasks, or -1 if the run
+ * queue is empty
+ */
+static int rq_highest_priority(struct runqueue *rq)
+{
+  int word;
+
+  if (rq->summary == 0)
+    return -1;
+
+  word = fls_bit(rq->summary);
+  return (word << 5) + fls_bit(rq->bitmap[word]);
+}
+
+/**
+ * @brief Removes and returns the first task of the highest priority level,
+ * or NULL if the run queue is empty
+ */
+static struct task_struct *rq_pick_next(struct runqueue *rq)
+{
+  struct task_struct *t;
+  int prio = rq_highest_priority(rq);
+
+  if (prio < 0)
+    return NULL;
+
+  t = list_head_to_task_struct(list_first(&rq->queue[prio]));
+  rq_dequeue(t);
+  return t;
+}
+
+
+/* Called every clock tick: closes the one second window of 'ops_per_sec' */
+void rq_update_rate(void)
+{
+  int cpu;
+
+  for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+    struct runqueue *rq = &runqueues[cpu];
+
+    if (zeos_ticks - rq->window_start >= HZ) {
+      rq->ops_per_sec = rq->nr_ops - rq->ops_mark;
+      rq->ops_mark = rq->nr_ops;
+      rq->window_start = zeos_ticks;
+    }
+  }
+}
+
+static void rr_init(void)
+{
+  int cpu;
+
+  for (cpu = 0; cpu < MAX_CPUS; cpu++)
+    init_runqueue(&runqueues[cpu]);
+}
+
+static void rr_enqueue(struct task_struct *t)
+{
+  // Ensure thread priority matches master thread
+  if (t->master_thread != t)
+    t->priority = t->master_thread->priority;
+
+  rq_enqueue(t);
+}
+
+static void rr_dequeue(struct task_struct *t)
+{
+  rq_dequeue(t);
+}
+
+static struct task_struct *rr_pick_next(int cpu)
+{
+  return rq_pick_next(&runqueues[cpu]);
+}
+
+static int rr_tick(struct task_struct *t)
+{
+  struct cpu *c = &cpus[t->cpu];
+
+  c->remaining_quantum--;
+
+  // Check if current quantum is over
+  if (c->remaining_quantum == 0) {
+    if (c->nr_ready > 0) return 1;
+    c->remaining_quantum = sched_tune_quantum(t);
+    return 0;
+  }
+
+  // Check if there's a higher priority thread in ready queue
+  return rq_highest_priority(&runqueues[t->cpu]) > task_prio(t);
+}
+
+static int rr_wakeup(struct task_struct *t)
+{
+  rr_enqueue(t);
+  return task_prio(t) > task_prio(cpu_curr(t->cpu));
+}
+
+/* Moves 't' to the level of its new priority */
+static void rr_prio_changed(struct task_struct *t, int old_prio)
+{
+  rq_dequeue_prio(t, old_prio);
+  rq_enqueue(t);
+}
+
+struct sched_class rr_sched_class = {
+  .name      = "rr",
+  .init      = rr_init,
+  .pick_next = rr_pick_next,
+  .enqueue   = rr_enqueue,
+  .dequeue   = rr_dequeue,
+  .tick      = rr_tick,
+  .wakeup    = rr_wakeup,
+  .prio_changed = rr_prio_changed,
+};
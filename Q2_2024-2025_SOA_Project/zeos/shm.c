@@ -0,0 +1,218 @@
+/*
+ * shm.c - Shared memory segments
+ *
+ * shmget() makes a segment of zeroed frames, or finds the one of a key.
+ * shmat() maps all of them in the page table of the process, read and
+ * write, at an address it is given or picks, so processes exchange data in
+ * place. An attachment is a VMA_SHM area of the process: its threads see
+ * it, a fork inherits it and the exit drops it.
+ */
+
+#include <types.h>
+#include <mm.h>
+#include <sched.h>
+#include <slab.h>
+#include <shm.h>
+#include <vma.h>
+#include <utils.h>
+#include <errno.h>
+
+static struct kmem_cache *shm_segment_cache;
+
+static struct list_head shm_segments;
+static int next_shm_id = 1;
+
+void init_shm(void)
+{
+  INIT_LIST_HEAD(&shm_segments);
+  shm_segment_cache = kmem_cache_create("shm_segment", sizeof(struct shm_segment), NULL);
+}
+
+/* Frees the frames of 'seg' not mapped anywhere, and 'seg' */
+static void shm_destroy(struct shm_segment *seg)
+{
+  int i;
+
+  for (i = 0; i < seg->nr_pages; i++)
+    free_frame(seg->frames[i]);
+  list_del(&seg->list);
+  kmem_cache_free(shm_segment_cache, seg);
+}
+
+/* Returns the segment 'id', if it has not been removed */
+struct shm_segment *shm_find(int id)
+{
+  struct list_head *pos;
+  struct shm_segment *seg;
+
+  list_for_each(pos, &shm_segments) {
+    seg = list_entry(pos, struct shm_segment, list);
+    if (seg->id == id && !seg->removed)
+      return seg;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Returns the id of the segment of 'key', made with 'size' bytes of
+ * zeroed frames if there is none yet (always with SHM_PRIVATE)
+ * @return The id, -EINVAL for a wrong size or one larger than the existing
+ *         segment, -ENOMEM if there are not enough free frames
+ */
+int shm_get(int key, int size)
+{
+  struct list_head *pos;
+  struct shm_segment *seg;
+  int i, nr_pages, frame;
+
+  if (size <= 0 || size > SHM_MAX_PAGES * PAGE_SIZE)
+    return -EINVAL;
+  nr_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  if (key != SHM_PRIVATE)
+    list_for_each(pos, &shm_segments) {
+      seg = list_entry(pos, struct shm_segment, list);
+      if (seg->key == key && !seg->removed)
+        return nr_pages <= seg->nr_pages ? seg->id : -EINVAL;
+    }
+
+  seg = kmem_cache_alloc(shm_segment_cache);
+  if (seg == NULL)
+    return -ENOMEM;
+
+  for (i = 0; i < nr_pages; i++) {
+    frame = alloc_frame();
+    if (frame < 0) {
+      while (--i >= 0)
+        free_frame(seg->frames[i]);
+      kmem_cache_free(shm_segment_cache, seg);
+      return -ENOMEM;
+    }
+    memset(frame_to_kaddr(frame), 0, PAGE_SIZE);
+    seg->frames[i] = frame;
+  }
+
+  seg->id = next_shm_id++;
+  seg->key = key;
+  seg->nr_pages = nr_pages;
+  seg->nattch = 0;
+  seg->removed = 0;
+  list_add_tail(&seg->list, &shm_segments);
+  return seg->id;
+}
+
+/* Maps 'seg' from the logical page 'page' of the process of 'master',
+ * whose pages there must be free. Returns -ENOMEM if there is no memory, or
+ * -EMFILE if the segment is mapped too many times */
+int shm_attach(struct task_struct *master, struct shm_segment *seg,
+               unsigned int page)
+{
+  page_table_entry *PT = get_PT(master);
+  struct vma *vma;
+  int i;
+
+  vma = vma_create(master, page, page + seg->nr_pages, VMA_SHM,
+                   VM_READ | VM_WRITE);
+  if (vma == NULL)
+    return -ENOMEM;
+  vma->private = seg;
+
+  for (i = 0; i < seg->nr_pages; i++) {
+    if (share_frame(seg->frames[i]) < 0) {
+      // The frame reference count would overflow: undo the pages mapped
+      while (--i >= 0) {
+        free_frame(seg->frames[i]);
+        del_ss_pag(PT, page + i);
+      }
+      vma_destroy(vma);
+      return -EMFILE;
+    }
+    set_ss_pag(PT, page + i, seg->frames[i]);
+  }
+  seg->nattch++;
+  return 0;
+}
+
+/* Unmaps the shared memory area 'vma' of the page table 'PT'. The pages are
+ * queued in 'tlb', if the address space is still in use */
+static void shm_unmap(page_table_entry *PT, struct vma *vma,
+                      struct tlb_batch *tlb)
+{
+  struct shm_segment *seg = vma->private;
+  unsigned int page;
+
+  for (page = vma->start; page < vma->end; page++) {
+    free_frame(get_frame(PT, page));
+    del_ss_pag(PT, page);
+    if (tlb != NULL)
+      tlb_batch_add(tlb, page);
+  }
+  vma_destroy(vma);
+
+  if (--seg->nattch == 0 && seg->removed)
+    shm_destroy(seg);
+}
+
+/* Unmaps the segment attached at the logical page 'page' of the process
+ * of 'master', queuing its pages in 'tlb'. Returns -EINVAL if there is
+ * none */
+int shm_detach(struct task_struct *master, unsigned int page,
+               struct tlb_batch *tlb)
+{
+  struct vma *vma = find_vma(master, page);
+
+  if (vma == NULL || vma->type != VMA_SHM || vma->start != page)
+    return -EINVAL;
+
+  shm_unmap(get_PT(master), vma, tlb);
+  return 0;
+}
+
+/* Removes the segment 'id': it is freed once nobody has it attached.
+ * Returns -EINVAL if there is no such segment */
+int shm_remove(int id)
+{
+  struct shm_segment *seg = shm_find(id);
+
+  if (seg == NULL)
+    return -EINVAL;
+
+  seg->removed = 1;
+  if (seg->nattch == 0)
+    shm_destroy(seg);
+  return 0;
+}
+
+/* Attaches the segments of the process of 'parent' (a master thread) to the
+ * new process 'child', at the same addresses. Returns the error of
+ * shm_attach if one fails: the child is left with none */
+int shm_fork(struct task_struct *parent, struct task_struct *child)
+{
+  struct list_head *pos;
+  struct vma *vma;
+  int ret;
+
+  list_for_each(pos, &parent->vmas) {
+    vma = list_entry(pos, struct vma, list);
+    if (vma->type == VMA_SHM &&
+        (ret = shm_attach(child, vma->private, vma->start)) < 0) {
+      shm_exit(child);
+      return ret;
+    }
+  }
+  return 0;
+}
+
+/* Detaches every segment of the exiting process of 'master' */
+void shm_exit(struct task_struct *master)
+{
+  page_table_entry *PT = get_PT(master);
+  struct list_head *pos, *n;
+  struct vma *vma;
+
+  list_for_each_safe(pos, n, &master->vmas) {
+    vma = list_entry(pos, struct vma, list);
+    if (vma->type == VMA_SHM)
+      shm_unmap(PT, vma, NULL);
+  }
+}
@@ -0,0 +1,247 @@
+/*
+ * slab.c - Kernel object caches on top of the frame allocator
+ *
+ * A slab is a block of 2^order frames taken from the buddy allocator and
+ * seen through the kernel window. It starts with its descriptor, followed
+ * by the index of the next free object of every free object, and then the
+ * objects. Every frame of a slab points to the descriptor (frame private
+ * data), so kfree() finds the cache from the address alone.
+ */
+
+#include <types.h>
+#include <mm.h>
+#include <slab.h>
+#include <utils.h>
+
+struct slab {
+  struct list_head list;      /* In the full, partial or empty list */
+  struct kmem_cache *cache;
+  char *mem;                  /* First object */
+  int inuse;                  /* Objects in use */
+  int free;                   /* First free object, -1 if none */
+  short next[];               /* Free object after each free one, -1 ends */
+};
+
+#define ALIGN8(x) (((x) + 7) & ~7)
+
+/* Caches of the caches and of kmalloc */
+static struct kmem_cache cache_cache;
+static struct kmem_cache *kmalloc_caches[KMALLOC_CACHES];
+static char *kmalloc_names[KMALLOC_CACHES] = {
+  "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+  "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+static struct list_head caches;
+
+/* Offset of the first object of a slab of the cache */
+static unsigned int slab_mem_offset(int per_slab)
+{
+  return ALIGN8(sizeof(struct slab) + per_slab * sizeof(short));
+}
+
+/* Objects of 'size' bytes that fit a slab of 2^order frames */
+static int slab_capacity(unsigned int size, int order)
+{
+  unsigned int bytes = PAGE_SIZE << order;
+  int n = (bytes - sizeof(struct slab)) / (size + sizeof(short));
+
+  while (n > 0 && slab_mem_offset(n) + n * size > bytes)
+    n--;
+  return n;
+}
+
+/* Sets up 'cache'. The smallest slab wasting at most 1/8 of it is used */
+static void init_cache(struct kmem_cache *cache, char *name, unsigned int size,
+                       void (*ctor)(void *obj))
+{
+  int i, order, n;
+
+  for (i = 0; i < SLAB_NAME_LEN - 1 && name[i]; i++)
+    cache->name[i] = name[i];
+  cache->name[i] = 0;
+
+  cache->size = (size + 3) & ~3;
+  cache->ctor = ctor;
+  for (order = 0; order < SLAB_MAX_ORDER; order++) {
+    n = slab_capacity(cache->size, order);
+    if (n > 0 && (PAGE_SIZE << order) - n * cache->size <= (PAGE_SIZE << order) / 8)
+      break;
+  }
+  cache->order = order;
+  cache->per_slab = slab_capacity(cache->size, order);
+
+  INIT_LIST_HEAD(&cache->full);
+  INIT_LIST_HEAD(&cache->partial);
+  INIT_LIST_HEAD(&cache->empty);
+  list_add_tail(&cache->list, &caches);
+
+  memset(&cache->stats, 0, sizeof(struct slab_stats));
+  for (i = 0; i < SLAB_NAME_LEN; i++)
+    cache->stats.name[i] = cache->name[i];
+  cache->stats.obj_size = cache->size;
+  cache->stats.per_slab = cache->per_slab;
+  cache->stats.slab_frames = 1 << order;
+}
+
+/* Takes a new slab for 'cache' from the frame allocator, its objects built */
+static struct slab *cache_grow(struct kmem_cache *cache)
+{
+  struct slab *slab;
+  int frame, i;
+
+  frame = alloc_frames(cache->order);
+  if (frame < 0) {
+    cache->stats.failures++;
+    return NULL;
+  }
+
+  slab = frame_to_kaddr(frame);
+  for (i = 0; i < (1 << cache->order); i++)
+    set_frame_private(frame + i, slab);
+
+  slab->cache = cache;
+  slab->mem = (char *)slab + slab_mem_offset(cache->per_slab);
+  slab->inuse = 0;
+  slab->free = 0;
+  for (i = 0; i < cache->per_slab; i++) {
+    slab->next[i] = i + 1;
+    if (cache->ctor)
+      cache->ctor(slab->mem + i * cache->size);
+  }
+  slab->next[cache->per_slab - 1] = -1;
+
+  list_add(&slab->list, &cache->empty);
+  cache->stats.slabs++;
+  cache->stats.grows++;
+  return slab;
+}
+
+static void cache_shrink(struct kmem_cache *cache, struct slab *slab)
+{
+  list_del(&slab->list);
+  free_frames(kaddr_to_frame(slab), cache->order);
+  cache->stats.slabs--;
+  cache->stats.shrinks++;
+}
+
+void init_slab(void)
+{
+  int i;
+
+  INIT_LIST_HEAD(&caches);
+  init_cache(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), NULL);
+
+  for (i = 0; i < KMALLOC_CACHES; i++)
+    kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], KMALLOC_MIN << i, NULL);
+}
+
+/**
+ * @brief Creates a cache of objects of 'size' bytes
+ *
+ * @param name Shown in the stats, up to SLAB_NAME_LEN-1 characters are kept
+ * @param ctor Builds each object, when its slab is made. NULL if none
+ * @return The cache, or NULL if 'size' does not fit a slab or there is no
+ *         memory
+ */
+struct kmem_cache *kmem_cache_create(char *name, unsigned int size,
+                                     void (*ctor)(void *obj))
+{
+  struct kmem_cache *cache;
+
+  if (size == 0 || slab_capacity((size + 3) & ~3, SLAB_MAX_ORDER) == 0)
+    return NULL;
+
+  cache = kmem_cache_alloc(&cache_cache);
+  if (cache == NULL)
+    return NULL;
+
+  init_cache(cache, name, size, ctor);
+  return cache;
+}
+
+/* Returns a built object of 'cache', or NULL if there is no free frame */
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+  struct slab *slab;
+  void *obj;
+
+  if (!list_empty(&cache->partial))
+    slab = list_entry(list_first(&cache->partial), struct slab, list);
+  else if (!list_empty(&cache->empty))
+    slab = list_entry(list_first(&cache->empty), struct slab, list);
+  else if ((slab = cache_grow(cache)) == NULL)
+    return NULL;
+
+  obj = slab->mem + slab->free * cache->size;
+  slab->free = slab->next[slab->free];
+  slab->inuse++;
+
+  list_del(&slab->list);
+  list_add(&slab->list, slab->inuse == cache->per_slab ? &cache->full : &cache->partial);
+
+  cache->stats.active_objs++;
+  cache->stats.allocs++;
+  return obj;
+}
+
+/* Gives back 'obj', which must be built again, to 'cache' */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+  struct slab *slab = frame_private(kaddr_to_frame(obj));
+  int idx = ((char *)obj - slab->mem) / cache->size;
+
+  slab->next[idx] = slab->free;
+  slab->free = idx;
+  slab->inuse--;
+
+  cache->stats.active_objs--;
+  cache->stats.frees++;
+
+  if (slab->inuse > 0) {
+    list_del(&slab->list);
+    list_add(&slab->list, &cache->partial);
+  }
+  else if (list_empty(&cache->empty)) {
+    list_del(&slab->list);
+    list_add(&slab->list, &cache->empty);
+  }
+  else
+    cache_shrink(cache, slab);
+}
+
+/* Returns 'size' bytes of kernel memory, up to KMALLOC_MAX, or NULL */
+void *kmalloc(unsigned int size)
+{
+  int i;
+
+  for (i = 0; i < KMALLOC_CACHES; i++)
+    if (size <= (KMALLOC_MIN << i))
+      return kmem_cache_alloc(kmalloc_caches[i]);
+  return NULL;
+}
+
+void kfree(void *obj)
+{
+  struct slab *slab;
+
+  if (obj == NULL)
+    return;
+
+  slab = frame_private(kaddr_to_frame(obj));
+  kmem_cache_free(slab->cache, obj);
+}
+
+/* Fills 's' with the stats of the cache 'idx' (in creation order). Returns
+ * -1 if there is no such cache */
+int get_slab_stats(int idx, struct slab_stats *s)
+{
+  struct list_head *pos;
+
+  list_for_each(pos, &caches)
+    if (idx-- == 0) {
+      *s = list_entry(pos, struct kmem_cache, list)->stats;
+      return 0;
+    }
+  return -1;
+}
@@ -0,0 +1,339 @@
+/*
+ * smp.c - Application processor bring-up, local APIC and kernel lock
+ *
+ * The bootstrap processor (CPU 0) keeps the PIT, the keyboard and the
+ * kernel timers. The application processors are started with the INIT /
+ * STARTUP IPI sequence of the MP specification and get their clock tick
+ * from the timer of their local APIC. Every CPU runs its own idle task and
+ * schedules the READY tasks of its own queues, stealing from the busiest
+ * CPU when it has none.
+ */
+
+#include <types.h>
+#include <hardware.h>
+#include <segment.h>
+#include <interrupt.h>
+#include <sched.h>
+#include <mm.h>
+#include <io.h>
+#include <utils.h>
+
+struct cpu cpus[MAX_CPUS];
+int nr_cpus = 1;
+
+spinlock_t kernel_lock = SPIN_LOCK_UNLOCKED;
+
+/* Idle tasks of the application processors. Their kernel stacks are the
+ * ones the APs start with (see trampoline.S) */
+union task_union ap_idle_tasks[MAX_CPUS-1]
+  __attribute__((__section__(".data.task")));
+
+/* Page table with the registers of the local APIC */
+page_table_entry lapic_table[TOTAL_PAGES]
+  __attribute__((__section__(".data.task")));
+
+static TSS ap_tss[MAX_CPUS];
+
+/* Read by trampoline.S */
+DWord ap_boot_cr3;     /* Directory the APs enable paging with */
+int ap_next_id = 1;    /* CPU number of the next AP to start */
+
+static volatile int smp_started = 0;
+static int has_lapic = 0;
+static DWord lapic_timer_count; /* APIC timer cycles per clock tick */
+
+/* ICR: delivery mode, level and destination shorthand */
+#define ICR_FIXED          0x00000000
+#define ICR_INIT           0x00000500
+#define ICR_STARTUP        0x00000600
+#define ICR_BUSY           0x00001000
+#define ICR_ASSERT         0x00004000
+#define ICR_ALL_BUT_SELF   0x000C0000
+
+/* PIT cycles in 'us' microseconds (at most 54 ms) */
+#define PIT_US(us) ((PIT_FREQ / 1000) * (us) / 1000)
+
+void ap_trampoline(void);
+void ap_trampoline_end(void);
+
+static inline DWord lapic_read(int reg)
+{
+  return *(volatile DWord *)(LAPIC_BASE + reg);
+}
+
+static inline void lapic_write(int reg, DWord value)
+{
+  *(volatile DWord *)(LAPIC_BASE + reg) = value;
+}
+
+static inline void local_flush_tlb(void)
+{
+  __asm__ __volatile__(
+    "movl %%cr3, %%eax\n\t"
+    "movl %%eax, %%cr3"
+    : : : "eax", "memory");
+}
+
+/* CPUID.1:EDX bit 9 */
+static int cpu_has_apic(void)
+{
+  DWord a = 1, b, c, d;
+
+  __asm__ __volatile__("cpuid" : "+a" (a), "=b" (b), "=c" (c), "=d" (d));
+  return (d >> 9) & 1;
+}
+
+/* Busy waits 'count' PIT cycles. Only before the clock is started */
+static void pit_wait(unsigned int count)
+{
+  set_timer_oneshot(count);
+  while (!timer_fired())
+    ;
+}
+
+/* Maps the local APIC registers, uncached, in lapic_table (every page
+ * directory points to it) */
+static void map_lapic(void)
+{
+  page_table_entry *pte = &lapic_table[(LAPIC_BASE >> 12) & (TOTAL_PAGES-1)];
+
+  pte->entry = 0;
+  pte->bits.pbase_addr = LAPIC_BASE >> 12;
+  pte->bits.rw = 1;
+  pte->bits.write_t = 1;
+  pte->bits.cache_d = 1;
+  pte->bits.global = 1;
+  pte->bits.present = 1;
+}
+
+static void lapic_send_ipi(int apic_id, DWord icr)
+{
+  lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+  lapic_write(LAPIC_ICR_LOW, icr);
+  while (lapic_read(LAPIC_ICR_LOW) & ICR_BUSY)
+    __asm__ __volatile__("pause");
+}
+
+static void lapic_enable(void)
+{
+  lapic_write(LAPIC_SVR, 0x100 | SPURIOUS_VECTOR);
+}
+
+/* Counts the APIC timer cycles (divided by 16) in one tick of the PIT */
+static void calibrate_lapic_timer(void)
+{
+  lapic_write(LAPIC_TIMER_DIV, 0x3);
+  lapic_write(LAPIC_LVT_TIMER, 0x10000);   /* Masked, one-shot */
+  lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+  pit_wait(LATCH);
+  lapic_timer_count = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+/* HZ interrupts per second on LAPIC_TIMER_VECTOR */
+static void lapic_timer_start(void)
+{
+  lapic_write(LAPIC_TIMER_DIV, 0x3);
+  lapic_write(LAPIC_LVT_TIMER, 0x20000 | LAPIC_TIMER_VECTOR); /* Periodic */
+  lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+}
+
+/* GDT entry KERNEL_TSS + cpu: an available 32-bit TSS */
+static void set_tss_desc(int cpu, TSS *t)
+{
+  Descriptor *d = &gdt[(KERNEL_TSS >> 3) + cpu];
+
+  d->limit = sizeof(TSS);
+  d->lowBase = lowWord((DWord)t);
+  d->midBase = midByte((DWord)t);
+  d->flags1 = 0x89;
+  d->flags2 = 0;
+  d->highBase = highByte((DWord)t);
+}
+
+void lapic_eoi(void)
+{
+  if (has_lapic)
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/* Fills the data of the bootstrap CPU, before the scheduler starts */
+void init_boot_cpu(void)
+{
+  cpus[0].id = 0;
+  cpus[0].online = 1;
+  cpus[0].tss = &tss;
+  cpus[0].in_kernel = 1;
+}
+
+/**
+ * @brief Entry point of the application processors, called by trampoline.S
+ * on the kernel stack of their idle task
+ * @param id CPU number (1..MAX_CPUS-1)
+ */
+void ap_main(int id)
+{
+  struct cpu *c = &cpus[id];
+
+  set_idt_reg(&idtR);
+
+  copy_data(&tss, &ap_tss[id], sizeof(TSS));
+  ap_tss[id].esp0 = KERNEL_ESP(&ap_idle_tasks[id-1]);
+  set_task_reg(KERNEL_TSS + (id << 3));
+  setSysenter();
+
+  lapic_enable();
+  lapic_write(LAPIC_LVT_LINT0, 0x10000);   /* The PIC only reaches CPU 0 */
+  lapic_write(LAPIC_LVT_LINT1, 0x400);     /* NMI */
+
+  c->id = id;
+  c->apic_id = lapic_read(LAPIC_ID) >> 24;
+  c->tss = &ap_tss[id];
+  c->curr = c->idle;
+  c->active_dir = (page_table_entry *)ap_boot_cr3;
+  c->loaded_dir = c->active_dir;
+  c->in_kernel = 1;
+
+  lapic_timer_start();
+  __sync_fetch_and_add(&nr_cpus, 1);
+
+  while (!smp_started)
+    __asm__ __volatile__("pause");
+
+  kernel_enter();
+  c->online = 1;
+  cpu_idle();
+}
+
+/**
+ * @brief Starts the application processors
+ *
+ * Called by the bootstrap CPU after the scheduler and task 1 are ready and
+ * before the clock starts. Without a local APIC the system runs on one CPU.
+ */
+void smp_init(void)
+{
+  int i;
+
+  if (!cpu_has_apic()) {
+    printk("No local APIC, 1 CPU. ");
+    return;
+  }
+  has_lapic = 1;
+
+  map_lapic();
+  lapic_enable();
+  lapic_write(LAPIC_LVT_LINT0, 0x700);     /* ExtINT: the PIC */
+  lapic_write(LAPIC_LVT_LINT1, 0x400);     /* NMI */
+  cpus[0].apic_id = lapic_read(LAPIC_ID) >> 24;
+
+  calibrate_lapic_timer();
+
+  for (i = 1; i < MAX_CPUS; i++) {
+    struct task_struct *idle = &ap_idle_tasks[i-1].task;
+
+    init_idle_task(idle, i);
+    idle->dir_pages_baseAddr = get_DIR(idle_task);
+    set_tss_desc(i, &ap_tss[i]);
+  }
+  ap_boot_cr3 = (DWord)get_DIR(idle_task);
+
+  copy_data(ap_trampoline, (void *)AP_TRAMPOLINE,
+            (int)ap_trampoline_end - (int)ap_trampoline);
+
+  /* INIT, then STARTUP twice as the MP specification asks */
+  lapic_send_ipi(0, ICR_ALL_BUT_SELF | ICR_ASSERT | ICR_INIT);
+  pit_wait(PIT_US(10000));
+  for (i = 0; i < 2; i++) {
+    lapic_send_ipi(0, ICR_ALL_BUT_SELF | ICR_ASSERT | ICR_STARTUP |
+                      (AP_TRAMPOLINE >> 12));
+    pit_wait(PIT_US(200));
+  }
+
+  /* Give the APs some time to check in */
+  for (i = 0; i < 10 && nr_cpus < MAX_CPUS; i++)
+    pit_wait(PIT_US(10000));
+
+  printk("CPUs: ");
+  print_number(nr_cpus);
+  printk(". ");
+}
+
+/* Lets the APs schedule. Called by CPU 0 right before entering user mode */
+void smp_start(void)
+{
+  cpus[0].in_kernel = 0;
+  smp_started = 1;
+}
+
+/* Makes 'cpu' enter the kernel and look at its queues */
+void send_reschedule(int cpu)
+{
+  if (has_lapic)
+    lapic_send_ipi(cpus[cpu].apic_id, ICR_FIXED | ICR_ASSERT | RESCHEDULE_VECTOR);
+}
+
+/**
+ * @brief Shoots down the TLB entries of the address space 'dir' in the other
+ * CPUs, after some of its pages have been unmapped
+ *
+ * A CPU that keeps 'dir' loaded only because its idle task runs reloads CR3
+ * at its next task switch. A CPU running a task of 'dir' is interrupted and
+ * flushes its TLB when it takes the kernel lock; until then it is waiting
+ * for the lock, so it cannot touch the pages.
+ */
+void flush_tlb_mm(page_table_entry *dir)
+{
+  int i, self = smp_processor_id();
+
+  for (i = 0; i < MAX_CPUS; i++) {
+    struct cpu *c = &cpus[i];
+
+    if (i == self || !c->online || c->active_dir != dir)
+      continue;
+
+    if (is_idle_task(c->curr)) {
+      c->active_dir = NULL;
+      continue;
+    }
+
+    c->tlb_flush = 1;
+    send_reschedule(i);
+    while (!c->in_kernel)
+      __asm__ __volatile__("pause");
+  }
+}
+
+/**
+ * @brief Takes the kernel lock on every entry to the kernel
+ *
+ * A thread killed by sys_exit while it was running here is freed now and
+ * never goes back to user mode.
+ */
+void kernel_enter(void)
+{
+  struct cpu *c = this_cpu();
+  struct task_struct *t;
+
+  c->in_kernel = 1;
+  lock_kernel();
+
+  if (c->tlb_flush) {
+    c->tlb_flush = 0;
+    local_flush_tlb();
+  }
+
+  t = current();
+  if (t->exiting) {
+    t->exiting = 0;
+    list_add_tail(&t->list, &freequeue);
+    sched_next_rr();
+  }
+}
+
+/* Releases the kernel lock on the way back to user mode (or to 'hlt') */
+void kernel_exit(void)
+{
+  this_cpu()->in_kernel = 0;
+  unlock_kernel();
+}
@@ -9,6 +9,12 @@
 
 #include <mm.h>
 
+#include <slab.h>
+
+#include <shm.h>
+
+#include <vma.h>
+
 #include <mm_address.h>
 
 #include <sched.h>
@@ -19,13 +25,13 @@
 
 #include <types.h>
 
+#include <interrupt.h>
+
 // External declaration of pthread_create from user code
 extern int pthread_create(void *(*func)(void*), void *param, int stack_size);
-extern void insert_ready_ordered(struct task_struct *t);
 
 #define LECTURA 0
 #define ESCRIPTURA 1
-#define MAX_PRIORITY 100
 #define MAX_STACK_SIZE 65536
 
 // ! CLONE_THREAD and CLONE_PROCESS
@@ -34,6 +40,11 @@ extern void insert_ready_ordered(struct task_struct *t);
 #define DEFAULT_STACK_SIZE 1024
 #define DEFAULT_REGION PAG_LOG_INIT_DATA+NUM_PAG_DATA
 
+// Heap (sys_sbrk): pages in use up to the end 'brk'
+#define HEAP_START (PAG_LOG_INIT_HEAP << 12)
+#define HEAP_END ((PAG_LOG_INIT_HEAP + NUM_PAG_HEAP) << 12)
+#define heap_pages(brk) (((brk) - HEAP_START + PAGE_SIZE - 1) >> 12)
+
 void * get_ebp();
 
 int check_fd(int fd, int permissions)
@@ -109,6 +120,34 @@ int sys_gettime()
   return zeos_ticks;
 }
 
+/* Takes a task of an exiting process out of the ready or a blocked queue */
+static void detach_task(struct task_struct *t)
+{
+  if (t->state == ST_READY)
+    sched_dequeue(t);
+  else if (t->state == ST_BLOCKED)
+    list_del(&t->list);
+
+  del_timer(&t->pause_timer);
+  sched_leave(t);
+}
+
+/* Returns the task struct of a thread of an exiting process to the free
+ * queue. A thread running on another CPU cannot be freed under its feet:
+ * it frees itself at its next kernel entry */
+static void release_task(struct task_struct *t)
+{
+  unhash_task(t);
+
+  if (t->state == ST_RUN && t != current()) {
+    t->exiting = 1;
+    return;
+  }
+
+  detach_task(t);
+  list_add_tail(&t->list, &freequeue);
+}
+
 // ! Modified
 // Releases all threads and all memory (data + user stacks of threads)
 void sys_exit() {  
@@ -122,13 +161,16 @@ void sys_exit() {
         del_ss_pag(process_PT, PAG_LOG_INIT_DATA + i);
     }
 
-    // Free the semaphores
-    for (int i = 0; i < MAX_SEMAPHORES; i++) {
-        master_th->semaphores->sem[i].TID = -1;
-        master_th->semaphores->sem[i].count = -1;
-        INIT_LIST_HEAD(&master_th->semaphores->sem[i].blocked);
+    // Free the heap
+    for (int i = 0; i < heap_pages(master_th->heap_brk); i++) {
+        free_frame(get_frame(process_PT, PAG_LOG_INIT_HEAP + i));
+        del_ss_pag(process_PT, PAG_LOG_INIT_HEAP + i);
     }
 
+    // Detach the shared memory, and drop the memory areas
+    shm_exit(master_th);
+    vma_exit(master_th);
+
     // If there are threads, free them
     if (!list_empty(&master_th->threads)) {
       struct list_head *lm = list_first(&master_th->threads);
@@ -150,11 +192,9 @@ void sys_exit() {
           } 
         }
 
-        // Remove the thread from the list
-        list_del(&ts->list);
-          
-        // Add the task_struct to the free queue
-        list_add_tail(&ts->list, &freequeue);
+        // Remove the thread from the ready or blocked queue and add the
+        // task_struct to the free queue
+        release_task(ts);
 
         lm = lm->next;
       }
@@ -176,7 +216,20 @@ void sys_exit() {
     master_th->thread_count = 0;
 
     // Add the master thread to the free queue
-    list_add_tail(&master_th->list, &freequeue);
+    release_task(master_th);
+
+    // Free the semaphores, once no thread is left queued on them
+    free_sem_array(master_th->semaphores);
+    master_th->semaphores = NULL;
+
+    // Threads still running on other CPUs enter the kernel now, and no CPU
+    // keeps the directory lazily loaded. This CPU needs no invalidation:
+    // the directory is dropped below, so the next task reloads CR3
+    flush_tlb_mm(get_DIR(master_th));
+
+    // The directory may be reused by a new process: never skip its reload
+    if (this_cpu()->active_dir == get_DIR(master_th))
+      this_cpu()->active_dir = NULL;
 
     // Schedule the next process   
     sched_next_rr();
@@ -189,25 +242,245 @@ int sys_yield()
   return 0;
 }
 
-extern int remaining_quantum;
+/* Thread 'tid' of the process of 't', or NULL */
+static struct task_struct *find_thread(struct task_struct *t, int tid)
+{
+  struct task_struct *master = t->master_thread;
+  struct list_head *l;
+
+  if (master->TID == tid)
+    return master;
+
+  list_for_each(l, &master->threads) {
+    struct task_struct *th = list_head_to_task_struct(l);
+
+    if (th->TID == tid)
+      return th;
+  }
+  return NULL;
+}
+
+// Directed yield to another thread of this process, which must be READY
+int sys_yield_to(int tid)
+{
+  struct task_struct *t = find_thread(current(), tid);
+
+  if (t == NULL)
+    return -ESRCH;
+
+  return sched_yield_to(t);
+}
 
 int sys_get_stats(int pid, struct stats *st)
 {
-  int i;
+  struct task_struct *t;
   
   if (!access_ok(VERIFY_WRITE, st, sizeof(struct stats))) return -EFAULT; 
   
   if (pid<0) return -EINVAL;
-  for (i=0; i<NR_TASKS; i++)
-  {
-    if (task[i].task.PID==pid)
-    {
-      task[i].task.p_stats.remaining_ticks=remaining_quantum;
-      copy_to_user(&(task[i].task.p_stats), st, sizeof(struct stats));
-      return 0;
+  t = find_task_by_pid(pid);
+  if (t == NULL) return -ESRCH; /*ESRCH */
+
+  t->p_stats.remaining_ticks=cpus[t->cpu].remaining_quantum;
+  t->p_stats.quantum=get_quantum(t);
+  copy_to_user(&(t->p_stats), st, sizeof(struct stats));
+  return 0;
+}
+
+/**
+ * @brief Copies the READY->RUN latency histogram of process 'pid', or the
+ * one of the whole system if 'pid' is 0
+ */
+int sys_get_latency(int pid, struct lat_hist *h)
+{
+  struct task_struct *t;
+
+  if (!access_ok(VERIFY_WRITE, h, sizeof(struct lat_hist))) return -EFAULT;
+
+  if (pid < 0) return -EINVAL;
+  if (pid == 0) {
+    copy_to_user(&sched_lat, h, sizeof(struct lat_hist));
+    return 0;
+  }
+  t = find_task_by_pid(pid);
+  if (t == NULL) return -ESRCH;
+
+  copy_to_user(&(t->lat), h, sizeof(struct lat_hist));
+  return 0;
+}
+
+int sys_get_mem_stats(struct mem_stats *st)
+{
+  struct mem_stats s;
+
+  if (!access_ok(VERIFY_WRITE, st, sizeof(struct mem_stats))) return -EFAULT;
+
+  get_mem_stats(&s);
+  copy_to_user(&s, st, sizeof(struct mem_stats));
+  return 0;
+}
+
+/* Copies the stats of the kernel object cache 'idx', from 0 */
+int sys_get_slab_stats(int idx, struct slab_stats *st)
+{
+  struct slab_stats s;
+
+  if (!access_ok(VERIFY_WRITE, st, sizeof(struct slab_stats))) return -EFAULT;
+
+  if (get_slab_stats(idx, &s) < 0) return -EINVAL;
+  copy_to_user(&s, st, sizeof(struct slab_stats));
+  return 0;
+}
+
+/**
+ * @brief Returns the id of the shared memory segment of 'key', with 'size'
+ * bytes of zeroed memory if it is new. 'key' 0 always makes a new one
+ */
+int sys_shmget(int key, int size)
+{
+  if (key < 0) return -EINVAL;
+  return shm_get(key, size);
+}
+
+/**
+ * @brief Maps the shared memory segment 'id' in the process, at 'addr' or,
+ * if it is NULL, at free pages above the screen page
+ * @return The address of the segment
+ */
+int sys_shmat(int id, void *addr)
+{
+  struct task_struct *master = current()->master_thread;
+  struct shm_segment *seg;
+  int page, ret;
+
+  seg = shm_find(id);
+  if (seg == NULL) return -EINVAL;
+
+  if (addr == NULL) {
+    page = vma_find_gap(master, DEFAULT_REGION+1, seg->nr_pages);
+    if (page < 0) return -ENOMEM;
+  } else {
+    // Page aligned, past the screen page and not in use
+    page = (unsigned int)addr >> 12;
+    if ((unsigned int)addr & (PAGE_SIZE - 1)) return -EINVAL;
+    if (page < DEFAULT_REGION+1 || page + seg->nr_pages > TOTAL_PAGES)
+      return -EINVAL;
+    if (vma_find_gap(master, page, seg->nr_pages) != page)
+      return -EINVAL;
+  }
+
+  ret = shm_attach(master, seg, page);
+  if (ret < 0) return ret;
+  return page << 12;
+}
+
+/* Unmaps the shared memory segment attached at 'addr' */
+int sys_shmdt(void *addr)
+{
+  struct task_struct *master = current()->master_thread;
+  struct tlb_batch tlb;
+  int ret;
+
+  if ((unsigned int)addr & (PAGE_SIZE - 1)) return -EINVAL;
+
+  tlb_batch_init(&tlb, get_DIR(master));
+  ret = shm_detach(master, (unsigned int)addr >> 12, &tlb);
+  if (ret < 0) return ret;
+
+  tlb_batch_flush(&tlb);
+  return 0;
+}
+
+/* Removes the shared memory segment 'id' once nobody has it attached */
+int sys_shmrm(int id)
+{
+  return shm_remove(id);
+}
+
+/**
+ * @brief Moves the end of the heap of the process 'increment' bytes. The
+ * pages it grows over get zeroed frames, those it shrinks over are freed
+ * @return The previous end of the heap
+ */
+int sys_sbrk(int increment)
+{
+  struct task_struct *master = current()->master_thread;
+  page_table_entry *PT = get_PT(master);
+  unsigned int old_brk = master->heap_brk;
+  struct tlb_batch tlb;
+  int page, old_end, new_end, frame;
+
+  if (increment > (int)(HEAP_END - old_brk) ||
+      increment < -(int)(old_brk - HEAP_START))
+    return -ENOMEM;
+
+  master->heap_brk = old_brk + increment;
+  old_end = PAG_LOG_INIT_HEAP + heap_pages(old_brk);
+  new_end = PAG_LOG_INIT_HEAP + heap_pages(master->heap_brk);
+
+  for (page = old_end; page < new_end; page++) {
+    frame = alloc_frame();
+    if (frame < 0) {
+      while (--page >= old_end) {
+        free_frame(get_frame(PT, page));
+        del_ss_pag(PT, page);
+      }
+      master->heap_brk = old_brk;
+      return -ENOMEM;
+    }
+    memset(frame_to_kaddr(frame), 0, PAGE_SIZE);
+    set_ss_pag(PT, page, frame);
+  }
+
+  if (new_end < old_end) {
+    tlb_batch_init(&tlb, get_DIR(master));
+    for (page = new_end; page < old_end; page++) {
+      free_frame(get_frame(PT, page));
+      del_ss_pag(PT, page);
+      tlb_batch_add(&tlb, page);
     }
+    tlb_batch_flush(&tlb);
   }
-  return -ESRCH; /*ESRCH */
+  return old_brk;
+}
+
+int sys_get_sched_stats(struct sched_stats *st)
+{
+  struct sched_stats s;
+  int cpu;
+
+  if (!access_ok(VERIFY_WRITE, st, sizeof(struct sched_stats))) return -EFAULT;
+
+  s.rq_ops = 0;
+  s.rq_ops_per_sec = 0;
+  s.steals = 0;
+  for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+    s.rq_ops += runqueues[cpu].nr_ops;
+    s.rq_ops_per_sec += runqueues[cpu].ops_per_sec;
+    s.steals += cpus[cpu].nr_stolen;
+  }
+  s.nr_running = nr_ready;
+  s.nr_cpus = nr_cpus;
+  s.mlfq_demotions = mlfq_stats.demotions;
+  s.mlfq_promotions = mlfq_stats.promotions;
+  s.mlfq_boosts = mlfq_stats.boosts;
+  s.pi_boosts = pi_stats.boosts;
+  s.pi_inversions = pi_stats.inversions;
+  s.pi_inversion_ticks = pi_stats.inversion_ticks;
+  s.pi_max_inversion_ticks = pi_stats.max_inversion_ticks;
+  s.directed_yields = nr_directed_yields;
+  s.switch_cost = quantum_stats.switch_cost;
+  s.switch_cost_max = quantum_stats.switch_cost_max;
+  s.tick_cycles = quantum_stats.tick_cycles;
+  s.min_quantum = quantum_stats.min_quantum;
+  s.edf_misses = edf_stats.misses;
+  s.edf_throttles = edf_stats.throttles;
+  s.edf_bandwidth = edf_stats.bandwidth;
+  s.cs_full = switch_stats.full;
+  s.cs_same_mm = switch_stats.same_mm;
+  s.tlb_flushes_avoided = switch_stats.same_mm + switch_stats.lazy_idle;
+  copy_to_user(&s, st, sizeof(struct sched_stats));
+  return 0;
 }
 
 // ------------------ MILESTONE 1 -------------------
@@ -228,14 +501,27 @@ int sys_GetKeyboardState(char *keyboard) {
 
 extern struct list_head blocked;
 // Pause
+/* Timer of sys_pause: 'data' is the paused task */
+static void pause_timeout(unsigned long data)
+{
+  update_process_state_rr((struct task_struct *)data, &readyqueue);
+}
+
 int sys_pause (int miliseconds) {
   struct task_struct *t = current();
+  int ticks;
   
   // Check if the time is valid
   if (miliseconds < 0) return -EINVAL;
 
-  // ! 18 ticks = 1 ms
-  t->pause_time = miliseconds * 0.018;  
+  ticks = miliseconds * HZ / 1000;
+
+  // Wake up at the first tick after the pause (at least the next one)
+  t->pause_timer.expires = zeos_ticks + (ticks > 0 ? ticks : 1);
+  t->pause_timer.function = pause_timeout;
+  t->pause_timer.data = (unsigned long)t;
+  add_timer(&t->pause_timer);
+
   update_process_state_rr(t, &blocked); // Block the process
   sched_next_rr();
 
@@ -252,11 +538,23 @@ void *sys_StartScreen() {
   if (t->screen_page != (void*)-1) {
     return t->screen_page;
   }
+
+  // Or another thread of the process mapped it
+  if (find_vma(t->master_thread, DEFAULT_REGION) != NULL) {
+    t->screen_page = (void*)((DEFAULT_REGION) << 12);
+    return t->screen_page;
+  }
   
   // Allocate a new physical page
   int phy_page = alloc_frame();
   if (phy_page < 0)
     return (void*)-EAGAIN;
+
+  if (vma_create(t->master_thread, DEFAULT_REGION, DEFAULT_REGION+1,
+                 VMA_SCREEN, VM_READ | VM_WRITE) == NULL) {
+    free_frame(phy_page);
+    return (void*)-ENOMEM;
+  }
   
   // Map the page to user space
   page_table_entry *process_PT = get_PT(t);
@@ -287,7 +585,9 @@ void *sys_StartScreen() {
  * +------------------+
  * |        ...       |
  * +------------------+
- * |    stack_base    |
+ * |    stack_base    | <- only the top page is mapped at first, the
+ * +------------------+    rest on first touch
+ * |    guard page    | <- never mapped
  * +------------------+
  * 
  * 
@@ -322,88 +622,6 @@ void *sys_StartScreen() {
 
 // ! Helper functions for sys_clone
 
-/**
- * @brief Search for contiguous free space in the page table
- * 
- * This function searches for a contiguous block of free pages in the page table,
- * taking into account the existing thread stacks to avoid overlaps.
- * 
- * Memory Layout Considered:
- * +------------------------+
- * | Thread 1 Stack         |
- * +------------------------+
- * | Thread 2 Stack         |
- * +------------------------+
- * | Master Thread Stack    |
- * +------------------------+
- * 
- * The function ensures that:
- * 1. The requested number of pages is available
- * 2. The pages are contiguous
- * 3. The pages don't overlap with existing thread stacks
- * 4. The pages are aligned to page boundaries
- * 
- * @param PT The page table to search in
- * @param start_page The starting page number to begin search
- * @param pages_needed The number of contiguous pages needed
- * @param master_th The master thread of the process
- * @return The first page number of the free space, or -1 if not found
- */
-int search_free_frame(page_table_entry *PT, int start_page, int pages_needed, struct task_struct *master_th) {
-  // Check if the number of pages is valid
-  if (pages_needed <= 0) return -1;
-
-  // Get the current task and its master thread
-  struct list_head   *threads_list = &master_th->threads_list;
-
-  // Search for contiguous free space
-  for (int i = start_page; i <= TOTAL_PAGES; ++i) {
-    // Check if the first page is free
-    if (PT[i].entry == 0) {
-      int new_start = i;
-      int new_end = i + pages_needed;
-      int conflict = 0;
-
-      // Check for conflicts with other threads' stacks
-      struct list_head *pos;
-      list_for_each(pos, threads_list) {
-        struct task_struct *thr = list_head_to_task_struct(pos);
-        
-        // Calculate thread's stack boundaries
-        int thr_start = ((unsigned int)thr->user_stack_ptr) >> 12;
-        int thr_end = thr_start + thr->user_stack_frames;
-
-        // Check for overlap
-        if (!(new_end <= thr_start || new_start >= thr_end)) {
-          conflict = 1;
-          i = thr_end - 1;  // Skip to after this thread's stack
-          break;
-        }
-      }
-
-      // Check for conflict with master thread's stack
-      if (!conflict && master_th->user_stack_ptr != NULL) {
-        int master_start = ((unsigned int)master_th->user_stack_ptr) >> 12;
-        int master_end = master_start + master_th->user_stack_frames;
-      
-        // Check if the new stack overlaps with the master's stack
-        if (!(new_end <= master_start || new_start >= master_end)) {
-          conflict = 1;
-          i = master_end - 1;  // Skip to after master's stack
-        }
-      }
-
-      // If no conflicts found, return the start page
-      if (!conflict) {
-        return i;
-      }
-    }
-  }
-
-  // If no free space is found, return -1
-  return -1;
-}
-
 /**
  * @brief Initialize common task fields for both threads and processes
  * @param task The task to initialize
@@ -412,7 +630,24 @@ int search_free_frame(page_table_entry *PT, int start_page, int pages_needed, st
 static void init_common_task_fields(struct task_struct *task, struct task_struct *parent) {
   task->state = ST_READY;
   task->priority = parent->priority;
-  task->pause_time = 0;
+  init_timer(&task->pause_timer);
+
+  // Reservations are not inherited: the child gets the class the parent
+  // had before becoming periodic
+  if (parent->sched_class == &edf_sched_class)
+    task->sched_class = parent->edf_prev_class;
+  init_timer(&task->edf_timer);
+
+  // Nothing inherited through the semaphores of the parent
+  task->pi_priority = 0;
+  task->pi_blocked_on = NULL;
+  task->pi_wait_start = 0;
+
+  // New tasks start at the top MLFQ level
+  task->mlfq_level = 0;
+  task->mlfq_used = 0;
+  task->mlfq_cpu_mark = 0;
+  task->mlfq_blocked_mark = 0;
   
   // Initialize thread lists
   INIT_LIST_HEAD(&(task->threads_list));
@@ -420,6 +655,7 @@ static void init_common_task_fields(struct task_struct *task, struct task_struct
   
   // Initialize stats
   init_stats(&(task->p_stats));
+  init_lat_hist(&(task->lat));
 }
 
 /**
@@ -427,22 +663,54 @@ static void init_common_task_fields(struct task_struct *task, struct task_struct
  * @param process_PT The process page table
  * @param start_page The start page to deallocate
  * @param num_pages Number of pages to deallocate
- * @param task_struct The task struct to return to free queue
+ * @param child The task union to free (it never ran)
  * @return Error code
  */
 static int handle_memory_error(page_table_entry *process_PT, int start_page, int num_pages, 
-                               struct list_head *task_struct) {
+                               union task_union *child) {
   // Deallocate allocated pages
   for (int i = 0; i < num_pages; i++) {
     free_frame(get_frame(process_PT, start_page + i));
     del_ss_pag(process_PT, start_page + i);
   }
   
-  // Return task struct to free queue
-  list_add_tail(task_struct, &freequeue);
+  free_task_union(child);
   return -EAGAIN;
 }
 
+/**
+ * @brief Shares pages copy-on-write with a child in clone
+ * @param parent_PT The parent page table, whose changed pages go to 'tlb'
+ * @param PT The child page table
+ * @param first The first page to share
+ * @param n Number of pages to share
+ * @return 0, or -1 if a frame has too many references (see unshare_cow_pages)
+ */
+static int share_cow_pages(page_table_entry *parent_PT, page_table_entry *PT,
+                           unsigned int first, int n, struct tlb_batch *tlb) {
+  for (int i = 0; i < n; i++) {
+    if (share_cow_page(parent_PT, PT, first + i) < 0)
+      return -1;
+    tlb_batch_add(tlb, first + i);
+  }
+  return 0;
+}
+
+/**
+ * @brief Drops the pages shared with a child by share_cow_pages in clone
+ * @param PT The child page table
+ * @param first The first page to drop
+ * @param n Number of pages to drop, the ones not mapped are skipped
+ */
+static void unshare_cow_pages(page_table_entry *PT, unsigned int first, int n) {
+  for (int i = 0; i < n; i++) {
+    if (PT[first + i].bits.present) {
+      free_frame(get_frame(PT, first + i));
+      del_ss_pag(PT, first + i);
+    }
+  }
+}
+
 /**
  * @brief Setup screen page for new task
  * @param child_task The child task
@@ -452,9 +720,9 @@ static int handle_memory_error(page_table_entry *process_PT, int start_page, int
  */
 static void setup_screen_page(struct task_struct *child_task, struct task_struct *parent_task, 
                               page_table_entry *process_PT, page_table_entry *parent_PT) {
-  if (parent_task->screen_page != (void*)-1) {
-    unsigned int frame_screen_page = get_frame(parent_PT, (unsigned)parent_task->screen_page >> 12);
-    unsigned int screen_log_page = (unsigned)parent_task->screen_page >> 12;
+  if (find_vma(parent_task->master_thread, DEFAULT_REGION) != NULL) {
+    unsigned int frame_screen_page = get_frame(parent_PT, DEFAULT_REGION);
+    unsigned int screen_log_page = DEFAULT_REGION;
     set_ss_pag(process_PT, screen_log_page, frame_screen_page);
     child_task->screen_page = (void*)(screen_log_page << 12);
   } else {
@@ -487,17 +755,16 @@ int sys_clone(int what, void *(*func)(void*), void *param, int stack_size) {
       return -EINVAL;
   }
 
-  // If there are no free task structs, return an error
-  if (list_empty(&freequeue)) 
-    return -ENOMEM;
+  // Give the frames of the dead tasks back first
+  reap_tasks();
 
-  // Get the first free task struct
-  struct list_head *lhcurrent = list_first(&freequeue);
-  list_del(lhcurrent);
+  // A frame for the new task struct and kernel stack
+  union task_union *uchild = alloc_task_union();
+  if (uchild == NULL) 
+    return -ENOMEM;
 
   // Copy the parent's task struct to the new thread/process
   struct task_struct *current_thread = current();
-  union task_union *uchild = (union task_union*)list_head_to_task_struct(lhcurrent);
   copy_data(current_thread, uchild, sizeof(union task_union));
 
   // Get the main thread (could be the current thread or its main thread)
@@ -505,25 +772,46 @@ int sys_clone(int what, void *(*func)(void*), void *param, int stack_size) {
   page_table_entry *process_PT = get_PT(&uchild->task);
   page_table_entry *parent_PT = get_PT(current());
 
+  // The memory areas of the process are kept in its master thread
+  INIT_LIST_HEAD(&uchild->task.vmas);
+
   // ! Thread creation
   if (what == CLONE_THREAD) {
     // Calculate number of pages needed for the stack
     int pages_needed = (stack_size + PAGE_SIZE - 1) / PAGE_SIZE;
 
-    // Find a free region of consecutive logical pages for the user stack
-    int stack_start = search_free_frame(process_PT, DEFAULT_REGION+1, pages_needed, master_thread);
+    // Reserve a free region of consecutive logical pages for the user
+    // stack, with an unmapped guard page below it
+    int stack_start = vma_find_gap(master_thread, DEFAULT_REGION+1,
+                                   STACK_GUARD_PAGES + pages_needed);
     if (stack_start == -1) {
-      list_add_tail(lhcurrent, &freequeue);
+      free_task_union(uchild);
       return -ENOMEM;
     }
+    struct vma *stack_vma = vma_create(master_thread, stack_start,
+                                       stack_start + STACK_GUARD_PAGES + pages_needed,
+                                       VMA_STACK, VM_READ | VM_WRITE);
+    if (stack_vma == NULL) {
+      free_task_union(uchild);
+      return -ENOMEM;
+    }
+    stack_vma->guard = STACK_GUARD_PAGES;
+    stack_vma->private = &uchild->task;
+    stack_start += STACK_GUARD_PAGES;
+
+    // Only the top page, which gets the argument, is mapped now. The
+    // others are on first touch (see stack_fault)
+    int user_stack_page = alloc_frame();
+    if (user_stack_page == -1) {
+      vma_destroy(stack_vma);
+      return handle_memory_error(process_PT, stack_start, 0, uchild);
+    }
+    set_ss_pag(process_PT, stack_start + pages_needed - 1, user_stack_page);
 
-    // Allocate and map pages for the user stack
-    for (int i = 0; i < pages_needed; i++) {
-      int user_stack_page = alloc_frame();
-      if (user_stack_page == -1) {
-        return handle_memory_error(process_PT, stack_start, i, lhcurrent);
-      }
-      set_ss_pag(process_PT, stack_start + i, user_stack_page);
+    // One more user of the address space
+    if (share_DIR(get_DIR(&uchild->task)) < 0) {
+      vma_destroy(stack_vma);
+      return handle_memory_error(process_PT, stack_start + pages_needed - 1, 1, uchild);
     }
 
     // Increment the thread count on the master thread
@@ -537,11 +825,12 @@ int sys_clone(int what, void *(*func)(void*), void *param, int stack_size) {
     // Share screen page with parent
     setup_screen_page(&uchild->task, master_thread, process_PT, parent_PT);
 
-    // Set up user stack for thread
-    int* user_stack_esp = (int*)(stack_start << 12);
-    user_stack_esp[stack_size - 1] = (int)param;      // Parameter
-    user_stack_esp[stack_size - 2] = (int)func;       // Function
-    user_stack_esp[stack_size - 3] = 0;               // Return address (never used)
+    // Set up user stack for thread: 'func' is entered with 'param' as its
+    // argument, on top of the stack
+    int* user_stack_top = (int*)((stack_start + pages_needed) << 12);
+    user_stack_top[-1] = (int)param;                  // Parameter
+    user_stack_top[-2] = 0;                           // Return address (never used)
+    int* user_stack_esp = &user_stack_top[-2];
 
     // Set up kernel stack [HARDWARE CONTEXT]
     uchild->stack[KERNEL_STACK_SIZE - 2] = (unsigned int)user_stack_esp;  // esp (user stack pointer)
@@ -551,90 +840,74 @@ int sys_clone(int what, void *(*func)(void*), void *param, int stack_size) {
     uchild->task.register_esp = (unsigned int) &(uchild->stack[KERNEL_STACK_SIZE - 18]);  // ebp
 
     // Store user stack pointer and frames
-    uchild->task.user_stack_ptr = user_stack_esp;
+    uchild->task.user_stack_ptr = (int*)(stack_start << 12);
     uchild->task.user_stack_frames = pages_needed;
 
     // Add to thread list
     list_add_tail(&(uchild->task.threads_list), &(master_thread->threads));
   } else {  
     // ! Process creation (like old sys_fork)
-    // Allocate and map pages for DATA
-    int new_ph_pag, pag, i;
-    for (pag=0; pag<NUM_PAG_DATA; pag++) {
-      new_ph_pag = alloc_frame();
-      if (new_ph_pag != -1) { /* One page allocated */
-        set_ss_pag(process_PT, PAG_LOG_INIT_DATA+pag, new_ph_pag);
-      } else {/* No more free pages left. Deallocate everything */
-        return handle_memory_error(process_PT, PAG_LOG_INIT_DATA, pag, lhcurrent);
-      }
+    struct sem_array *child_sems = alloc_sem_array(-1);
+    if (child_sems == NULL) {
+      free_task_union(uchild);
+      return -ENOMEM;
     }
 
-    // Find a free region for temporary mapping
-    int temp_frame_start = search_free_frame(process_PT, DEFAULT_REGION+1, NUM_PAG_DATA, master_thread);
-    if (temp_frame_start == -1) {
-      return -EFAULT; 
+    // Own page directory, with the kernel already mapped
+    int pag;
+    if (allocate_DIR(&uchild->task) < 0) {
+      free_sem_array(child_sems);
+      free_task_union(uchild);
+      return -ENOMEM;
     }
-
-    // Copy parent's SYSTEM and CODE to child
-    for (pag=0; pag<NUM_PAG_KERNEL; pag++) {
-      set_ss_pag(process_PT, pag, get_frame(parent_PT, pag));
+    process_PT = get_PT(&uchild->task);
+
+    // Same memory areas, and shared memory at the same addresses
+    int ret = vma_fork(master_thread, &uchild->task, current_thread) < 0 ?
+              -ENOMEM : shm_fork(master_thread, &uchild->task);
+    if (ret < 0) {
+      vma_exit(&uchild->task);
+      put_DIR(get_DIR(&uchild->task));
+      free_sem_array(child_sems);
+      free_task_union(uchild);
+      return ret;
     }
+
+    // Share parent's CODE with the child
     for (pag=0; pag<NUM_PAG_CODE; pag++) {
       set_ss_pag(process_PT, PAG_LOG_INIT_CODE+pag, get_frame(parent_PT, PAG_LOG_INIT_CODE+pag));
     }
 
-    /* Copy parent's DATA to child. We will use TOTAL_PAGES-1 as a temp logical page to map to */
-    for (pag = PAG_LOG_INIT_DATA; pag < NUM_PAG_DATA; pag++) {
-      // Get the scratch page that will be used to map the parent's page
-      int scratch_page = temp_frame_start + pag;
-
-      // Map the parent's page to the scratch page
-      set_ss_pag(parent_PT, scratch_page, get_frame(process_PT, pag));
-
-      // Copy the data from the parent's page to the scratch page
-      copy_data((void*)(pag<<12),           // Source: Parent's page
-                (void*)(scratch_page<<12),  // Destination: Scratch page
-                PAGE_SIZE);
-      
-      // Remove the parent's page from the scratch page
-      del_ss_pag(parent_PT, scratch_page);
+    // DATA is shared copy-on-write: each process gets its own copy of a
+    // page when it first writes it (see cow_fault). The pages of the
+    // parent become read-only. So are the heap and the user stack of the
+    // calling thread, at the same address
+    struct tlb_batch tlb;
+    int stack_page = (unsigned int)current_thread->user_stack_ptr >> 12;
+    int stack_frames = current_thread->user_stack_ptr != NULL ?
+                       current_thread->user_stack_frames : 0;
+    tlb_batch_init(&tlb, get_DIR(current()));
+    if (share_cow_pages(parent_PT, process_PT, PAG_LOG_INIT_DATA, NUM_PAG_DATA, &tlb) < 0 ||
+        share_cow_pages(parent_PT, process_PT, PAG_LOG_INIT_HEAP,
+                        heap_pages(master_thread->heap_brk), &tlb) < 0 ||
+        share_cow_pages(parent_PT, process_PT, stack_page, stack_frames, &tlb) < 0) {
+      // A frame would overflow its reference count. The pages of the
+      // parent already shared stay copy-on-write, which is harmless
+      tlb_batch_flush(&tlb);
+      unshare_cow_pages(process_PT, PAG_LOG_INIT_DATA, NUM_PAG_DATA);
+      unshare_cow_pages(process_PT, PAG_LOG_INIT_HEAP, heap_pages(master_thread->heap_brk));
+      unshare_cow_pages(process_PT, stack_page, stack_frames);
+      shm_exit(&uchild->task);
+      vma_exit(&uchild->task);
+      put_DIR(get_DIR(&uchild->task));
+      free_sem_array(child_sems);
+      free_task_union(uchild);
+      return -EAGAIN;
     }
+    tlb_batch_flush(&tlb);
 
-    /* Deny access to the child's memory space */
-    set_cr3(get_DIR(current()));
-
-    // Copy user stack to child if it exists
-    if (current_thread->TID != 1 && current_thread->user_stack_ptr != NULL) {
-      int stack_start = search_free_frame(process_PT, DEFAULT_REGION+1, current_thread->user_stack_frames, &uchild->task);
-      if (stack_start == -1) {
-        return handle_memory_error(process_PT, PAG_LOG_INIT_DATA, NUM_PAG_DATA, lhcurrent);
-      }
-
-      for (i = 0; i < current_thread->user_stack_frames; i++) {
-        new_ph_pag = alloc_frame();
-        if (new_ph_pag == -1) {
-          // Deallocate stack pages
-          handle_memory_error(process_PT, stack_start, i, NULL);
-          // Deallocate data pages
-          return handle_memory_error(process_PT, PAG_LOG_INIT_DATA, NUM_PAG_DATA, lhcurrent);
-        }
-        set_ss_pag(process_PT, stack_start + i, new_ph_pag);
-        set_ss_pag(parent_PT, temp_frame_start + i, new_ph_pag);
-        copy_data((void*)(unsigned)(current_thread->user_stack_ptr) + (i << 12),
-                  (void*)((stack_start + i) << 12),
-                  PAGE_SIZE);
-        del_ss_pag(parent_PT, temp_frame_start + i);
-      }
-
-      uchild->task.user_stack_ptr = (int*)(stack_start << 12);
-      uchild->task.user_stack_frames = current_thread->user_stack_frames;
-
-      // Set up kernel stack for process
-      unsigned int parent_esp = ((unsigned long *)KERNEL_ESP((union task_union*)current_thread))[-0x02];
-      unsigned int offset = parent_esp - (unsigned int)(current_thread->user_stack_ptr);
-      unsigned int new_esp = ((unsigned int)(uchild->task.user_stack_ptr)) + offset;
-      ((unsigned long *)KERNEL_ESP(uchild))[-0x02] = new_esp;
-    } else {
+    uchild->task.heap_brk = master_thread->heap_brk;
+    if (current_thread->user_stack_ptr == NULL) {
       uchild->task.user_stack_ptr = NULL;
       uchild->task.user_stack_frames = 0;
     }
@@ -659,26 +932,19 @@ int sys_clone(int what, void *(*func)(void*), void *param, int stack_size) {
     // Share screen page with parent
     setup_screen_page(&uchild->task, current_thread, process_PT, parent_PT);
 
-    // Get a free semaphore from the semaphore array
-    for (int i = 0; i < NR_TASKS; i++) {
-      // If the semaphore is free, set the owner and next_sem_id
-      if (semaphores[i].owner == -1) {
-        // Set the owner and next_sem_id
-        semaphores[i].owner = uchild->task.PID;
-        uchild->task.next_sem_id = i;
-        // Set the semaphore array
-        uchild->task.semaphores = &semaphores[i];
-        break;
-      }
-    }
+    // Its own semaphores
+    uchild->task.semaphores = child_sems;
+    child_sems->owner = uchild->task.PID;
   }
 
   // Initialize common task fields
   init_common_task_fields(&uchild->task, current_thread);
+  hash_task(&uchild->task);
 
-  // Add to ready queue with priority 
-  // If the inserted task has higher priority than current, force reschedule
-  insert_ready_ordered(&uchild->task);
+  // Add to the ready queue of its scheduling class
+  // If the new task should preempt current, force reschedule
+  if (sched_wakeup(&uchild->task))
+    force_task_switch();
 
   // Return the TID of the new thread or PID of the new process
   return (what == CLONE_THREAD) ? uchild->task.TID : uchild->task.PID;
@@ -696,6 +962,18 @@ int sys_SetPriority(int priority) {
   return 0;
 }
 
+// Periodic real-time task (EDF). Times in ticks, as gettime()
+int sys_set_deadline(int period, int budget, int deadline) {
+  return edf_set_params(current(), period, budget, deadline);
+}
+
+// End of the job of a periodic task: sleep until the next release
+int sys_wait_next_period() {
+  return edf_wait_next_period(current());
+}
+
+static void sem_drop_holder(struct task_struct *t);
+
 // Pthread exit
 int sys_pthread_exit() {
   struct task_struct *current_thread = current();
@@ -711,14 +989,25 @@ int sys_pthread_exit() {
 
   // Free the thread's stack
   if (current_thread->user_stack_ptr != NULL && current_thread->user_stack_frames > 0) {
+      struct tlb_batch tlb;
+
+      tlb_batch_init(&tlb, get_DIR(current_thread));
       for (int us_frame = 0; us_frame < current_thread->user_stack_frames; us_frame++) {
           unsigned int user_stack_page = ((unsigned int)current_thread->user_stack_ptr >> 12) + us_frame;
           free_frame(get_frame(pt, user_stack_page));
           del_ss_pag(pt, user_stack_page);  // Remove the stack page from the page table
+          tlb_batch_add(&tlb, user_stack_page);
       }
+      // A sibling may run next on this CPU without reloading CR3, and
+      // others on other CPUs, with the stack in their TLB
+      tlb_batch_flush(&tlb);
+
+      // Its pages are free for new stacks and segments
+      vma_destroy(find_vma(master_thread, (unsigned int)current_thread->user_stack_ptr >> 12));
   }
 
   // Mark the thread as unused
+  unhash_task(current_thread);
   current_thread->PID = -1;
   current_thread->TID = -1;
 
@@ -759,6 +1048,15 @@ int sys_pthread_exit() {
           }
       }
 
+      // Move the heap and the memory areas to the new master
+      new_master->heap_brk = master_thread->heap_brk;
+      INIT_LIST_HEAD(&new_master->vmas);
+      while (!list_empty(&master_thread->vmas)) {
+          lm = list_first(&master_thread->vmas);
+          list_del(lm);
+          list_add_tail(lm, &new_master->vmas);
+      }
+
       // Update the thread list
       list_del(&new_master->threads_list);
       lm = list_first(&master_thread->threads);
@@ -778,6 +1076,8 @@ int sys_pthread_exit() {
       }
   }
   // Add the task_struct to the free queue
+  sem_drop_holder(current_thread);
+  sched_leave(current_thread);
   list_add_tail(&current_thread->list, &freequeue);
 
   // Schedule the next thread
@@ -788,7 +1088,137 @@ int sys_pthread_exit() {
 
 // ------------------ MILESTONE 4 -------------------
 
-struct sem_array semaphores[NR_TASKS];
+/* Semaphore arrays of the processes */
+static struct kmem_cache *sem_array_cache;
+
+/* Builds the free semaphore array 'obj': every semaphore unused */
+static void sem_array_ctor(void *obj)
+{
+  struct sem_array *a = obj;
+
+  a->owner = -1;
+  for (int i = 0; i < MAX_SEMAPHORES; i++) {
+    a->sem[i].count = -1;
+    a->sem[i].TID = -1;
+    a->sem[i].mutex = 0;
+    a->sem[i].holder = NULL;
+    INIT_LIST_HEAD(&a->sem[i].blocked);
+  }
+}
+
+void init_sem_array(void)
+{
+  sem_array_cache = kmem_cache_create("sem_array", sizeof(struct sem_array),
+                                      sem_array_ctor);
+}
+
+/* Returns an array of unused semaphores for the process of 'owner', or
+ * NULL if there is no memory */
+struct sem_array *alloc_sem_array(int owner)
+{
+  struct sem_array *a = kmem_cache_alloc(sem_array_cache);
+
+  if (a != NULL)
+    a->owner = owner;
+  return a;
+}
+
+/* Gives back the semaphores of an exiting process */
+void free_sem_array(struct sem_array *a)
+{
+  sem_array_ctor(a);
+  kmem_cache_free(sem_array_cache, a);
+}
+
+struct pi_stats pi_stats;
+
+/* Queues 't' on 's' behind the waiters with its priority or a higher one */
+static void sem_add_waiter(struct sem_t *s, struct task_struct *t)
+{
+  struct list_head *pos;
+
+  list_for_each(pos, &s->blocked)
+    if (task_prio(list_head_to_task_struct(pos)) < task_prio(t))
+      break;
+  list_add_tail(&t->list, pos);
+}
+
+/**
+ * @brief Lends the priority of 'waiter' to the holder of 's'
+ *
+ * If the holder waits for another mutex, the priority goes on along the
+ * chain of holders.
+ */
+static void pi_boost(struct sem_t *s, struct task_struct *waiter)
+{
+  int prio = task_prio(waiter);
+  int depth = 0;
+
+  while (s != NULL && s->holder != NULL && depth++ < MAX_TASKS) {
+    struct task_struct *h = s->holder;
+
+    if (task_prio(h) >= prio)
+      break;
+
+    sched_set_pi_priority(h, prio);
+    pi_stats.boosts++;
+
+    // Keep the waiters of the next mutex in priority order
+    s = h->pi_blocked_on;
+    if (s != NULL) {
+      list_del(&h->list);
+      sem_add_waiter(s, h);
+    }
+  }
+}
+
+/* Sets the inherited priority of 't' to the one of the first waiter of the
+ * mutexes it still holds */
+static void pi_recompute(struct task_struct *t)
+{
+  struct sem_array *a = t->master_thread->semaphores;
+  int i, p, prio = 0;
+
+  for (i = 0; i < MAX_SEMAPHORES; i++) {
+    struct sem_t *s = &a->sem[i];
+
+    if (s->holder != t || list_empty(&s->blocked))
+      continue;
+
+    p = task_prio(list_head_to_task_struct(list_first(&s->blocked)));
+    if (p > prio)
+      prio = p;
+  }
+  sched_set_pi_priority(t, prio);
+}
+
+/* Takes 't' out of the waiters of its semaphore, accounting the priority
+ * inversion it may have suffered */
+static void sem_del_waiter(struct task_struct *t)
+{
+  list_del(&t->list);
+  t->pi_blocked_on = NULL;
+
+  if (t->pi_wait_start != 0) {
+    unsigned long d = get_ticks() - t->pi_wait_start;
+
+    pi_stats.inversion_ticks += d;
+    if (d > pi_stats.max_inversion_ticks)
+      pi_stats.max_inversion_ticks = d;
+    t->pi_wait_start = 0;
+  }
+}
+
+/* A thread that exits gives back the mutexes it holds */
+static void sem_drop_holder(struct task_struct *t)
+{
+  struct sem_array *a = t->master_thread->semaphores;
+  int i;
+
+  for (i = 0; i < MAX_SEMAPHORES; i++)
+    if (a->sem[i].holder == t)
+      a->sem[i].holder = NULL;
+}
  
 int sys_sem_init(int value) {
   struct task_struct *master = current()->master_thread;
@@ -800,6 +1230,8 @@ int sys_sem_init(int value) {
   // Initialize the semaphore at the next available position for this process
   master->semaphores->sem[master->next_sem_id].count = value;
   master->semaphores->sem[master->next_sem_id].TID = current()->TID;
+  master->semaphores->sem[master->next_sem_id].mutex = (value == 1);
+  master->semaphores->sem[master->next_sem_id].holder = NULL;
   master->semaphores->owner = current()->TID;
   INIT_LIST_HEAD(&master->semaphores->sem[master->next_sem_id].blocked);
   
@@ -816,24 +1248,41 @@ int sys_sem_wait(int sem_id) {
   if (sem_id < 0 || sem_id > MAX_SEMAPHORES || master->semaphores->sem[sem_id].TID == -1)
     return -EINVAL;
 
+  struct sem_t *s = &master->semaphores->sem[sem_id];
+  struct task_struct *t = current();
+
   // Decrease the semaphore count
-  master->semaphores->sem[sem_id].count -= 1;  
+  s->count -= 1;
 
   // Check if the semaphore is already locked
-  if (master->semaphores->sem[sem_id].count < 0) {
+  if (s->count < 0) {
+    // Waiting for a lower priority holder: priority inversion
+    if (s->holder != NULL && s->holder->priority < task_prio(t)) {
+      pi_stats.inversions++;
+      t->pi_wait_start = get_ticks();
+    }
+
     // Block the thread
-    current()->state = ST_BLOCKED;
-    list_add_tail(&(current()->list), &(master->semaphores->sem[sem_id].blocked));
+    t->state = ST_BLOCKED;
+    t->pi_blocked_on = s;
+    sem_add_waiter(s, t);
+    pi_boost(s, t);
 
     // Schedule the next thread
     sched_next_rr();
   }
+  else if (s->mutex)
+    s->holder = t;
 
   return 0;
 }
 
-// Semaphore post
-int sys_sem_post(int sem_id) {
+/**
+ * @brief Posts semaphore 'sem_id'
+ * @param handoff If a thread is woken up, switch to it directly, giving it
+ *        the rest of the quantum, instead of waiting for a scheduling round
+ */
+static int do_sem_post(int sem_id, int handoff) {
   struct task_struct *master = current()->master_thread;  
 
   // A process can only have MAX_SEMAPHORES semaphores
@@ -841,32 +1290,61 @@ int sys_sem_post(int sem_id) {
   if (sem_id < 0 || sem_id > MAX_SEMAPHORES || master->semaphores->sem[sem_id].TID == -1)
     return -EINVAL;
 
+  struct sem_t *s = &master->semaphores->sem[sem_id];
+  struct task_struct *holder = s->holder;
+
   // Increment the semaphore count
-  master->semaphores->sem[sem_id].count += 1;
+  s->count += 1;
+  s->holder = NULL;
 
   // If the semaphore is already locked, wake up a thread
-  if (master->semaphores->sem[sem_id].count >= 0) {
+  if (s->count >= 0) {
     struct list_head *l = NULL;
 
     // Check if the blocked list is empty
-    if (list_empty(&(master->semaphores->sem[sem_id].blocked)))
+    if (list_empty(&(s->blocked))) {
+      if (holder != NULL)
+        pi_recompute(holder);
       return -EAGAIN;
+    }
 
-    // Get the first blocked thread and remove it from the blocked list
-    l = list_first(&(master->semaphores->sem[sem_id].blocked));
-    list_del(l);
-
-    // Add the thread to the ready queue
+    // Get the highest priority blocked thread and remove it from the blocked list
+    l = list_first(&(s->blocked));
     struct task_struct *tu = (struct task_struct*)list_head_to_task_struct(l);  // Unlocked thread
-    tu->state = ST_READY;
-    list_add_tail(&tu->list, &readyqueue);
+    sem_del_waiter(tu);
+
+    // The mutex goes straight to the woken thread, with the waiters left
+    if (s->mutex) {
+      s->holder = tu;
+      pi_recompute(tu);
+    }
+    // The old holder loses the priority it inherited
+    if (holder != NULL)
+      pi_recompute(holder);
 
-    // update_process_state_rr(tu, &readyqueue);
+    // Add the thread to the ready queue
+    int preempt = sched_wakeup(tu);
+    if (handoff)
+      sched_yield_to(tu);
+    else if (preempt)
+      force_task_switch();
   }
+  else if (holder != NULL)
+    pi_recompute(holder);
 
   return 0;
 }
 
+// Semaphore post
+int sys_sem_post(int sem_id) {
+  return do_sem_post(sem_id, 0);
+}
+
+// Semaphore post, running the woken thread right away
+int sys_sem_post_and_yield(int sem_id) {
+  return do_sem_post(sem_id, 1);
+}
+
 // Semaphore destroy
 int sys_sem_destroy(int sem_id) {
   struct task_struct *master = current()->master_thread;
@@ -882,26 +1360,116 @@ int sys_sem_destroy(int sem_id) {
     return -EAGAIN;
 
   // Free the semaphore
-  master->semaphores->sem[sem_id].TID = -1;
+  struct sem_t *s = &master->semaphores->sem[sem_id];
+  struct task_struct *holder = s->holder;
+
+  s->TID = -1;
+  s->holder = NULL;
 
   // Wake up and notify all the threads blocked on the semaphore
-  if (!list_empty(&(master->semaphores->sem[sem_id].blocked))) {
+  if (!list_empty(&(s->blocked))) {
     struct list_head *pos, *tmp;
-    list_for_each_safe(pos, tmp, &(master->semaphores->sem[sem_id].blocked)) {
+    list_for_each_safe(pos, tmp, &(s->blocked)) {
       // Get the first blocked thread and remove it from the blocked list
       struct task_struct *tu = list_head_to_task_struct(pos);
-      list_del(pos);
+      sem_del_waiter(tu);
 
       // Add the thread to the ready queue
-      tu->state = ST_READY;
-      list_add_tail(&tu->list, &readyqueue);
+      sched_wakeup(tu);
       // update_process_state_rr(tu, &readyqueue);
     }
   }
+  if (holder != NULL)
+    pi_recompute(holder);
+
   // Free the semaphore (mark it as unused)
   master->semaphores->sem[sem_id].TID = -1;    
   master->semaphores->sem[sem_id].count = -1;
   master->next_sem_id--;
 
   return 0;
-}
\ No newline at end of file
+}
+
+// ------------------ FUTEX -------------------
+
+#define FUTEX_HASH_SIZE 16
+
+/* Threads sleeping in sys_futex_wait, hashed by user address */
+static struct list_head futex_queues[FUTEX_HASH_SIZE];
+
+void init_futex(void)
+{
+  int i;
+
+  for (i = 0; i < FUTEX_HASH_SIZE; i++)
+    INIT_LIST_HEAD(&futex_queues[i]);
+}
+
+static struct list_head *futex_queue(int *addr)
+{
+  return &futex_queues[((unsigned long)addr >> 2) % FUTEX_HASH_SIZE];
+}
+
+/* The futex word must be an aligned int of the user data */
+static int futex_addr_ok(int *addr)
+{
+  return ((unsigned long)addr & 3) == 0 &&
+         access_ok(VERIFY_WRITE, addr, sizeof(int));
+}
+
+/**
+ * @brief Sleeps on the user address 'addr' if it still holds 'val'
+ *
+ * The check and the sleep are atomic with respect to sys_futex_wake, so a
+ * wakeup sent after the user changed the word is never lost.
+ *
+ * @return 0 once woken up, -EAGAIN if '*addr' is not 'val', -EFAULT for a
+ *         wrong address
+ */
+int sys_futex_wait(int *addr, int val) {
+  struct task_struct *t = current();
+  int cur;
+
+  if (!futex_addr_ok(addr))
+    return -EFAULT;
+
+  copy_from_user(addr, &cur, sizeof(int));
+  if (cur != val)
+    return -EAGAIN;
+
+  t->futex_addr = addr;
+  t->futex_dir = get_DIR(t);
+  update_process_state_rr(t, futex_queue(addr));
+  sched_next_rr();
+
+  return 0;
+}
+
+/**
+ * @brief Wakes up to 'n' threads of this process sleeping on 'addr', in
+ * the order they went to sleep
+ * @return Number of threads woken up, or -EFAULT for a wrong address
+ */
+int sys_futex_wake(int *addr, int n) {
+  struct list_head *q, *pos, *tmp;
+  page_table_entry *dir = get_DIR(current());
+  int woken = 0;
+
+  if (!futex_addr_ok(addr))
+    return -EFAULT;
+
+  q = futex_queue(addr);
+  list_for_each_safe(pos, tmp, q) {
+    struct task_struct *w = list_head_to_task_struct(pos);
+
+    if (woken >= n)
+      break;
+    if (w->futex_addr != addr || w->futex_dir != dir)
+      continue;
+
+    update_process_state_rr(w, &readyqueue);
+    woken++;
+  }
+
+  return woken;
+}
@@ -68,7 +68,7 @@ int __attribute__((__section__(".text.main")))
   // compiler will know its final memory location. Otherwise it will try to use the
   // 'ds' register to access the address... but we are not ready for that yet
   // (we are still in real mode).
-  set_seg_regs(__KERNEL_DS, __KERNEL_DS, (DWord) &protected_tasks[5]);
+  set_seg_regs(__KERNEL_DS, __KERNEL_DS, (DWord) &protected_tasks[NR_BOOT_TASKS+1]);
 
   /*** DO *NOT* ADD ANY CODE IN THIS ROUTINE BEFORE THIS POINT ***/
 
@@ -79,6 +79,7 @@ int __attribute__((__section__(".text.main")))
   setGdt(); /* Definicio de la taula de segments de memoria */
   setIdt(); /* Definicio del vector de interrupcions */
   setTSS(); /* Definicio de la TSS */
+  init_boot_cpu(); /* Dades de la CPU 0 */
 
   /* Initialize Memory */
   init_mm();
@@ -98,10 +99,20 @@ int __attribute__((__section__(".text.main")))
   /* Move user code/data now (after the page table initialization) */
   copy_data((void *) KERNEL_START + *p_sys_size, usr_main, *p_usr_size);
 
+  /* From now on the kernel cannot write to read-only user pages either */
+  set_wp_flag();
+
+  /* Start the other CPUs (they wait for smp_start) */
+  smp_init();
+
 
   printk("Entering user mode...");
 
+  /* Clock at HZ interrupts per second */
+  set_timer_periodic(LATCH);
+
   enable_int();
+  smp_start();
   /*
    * We return from a 'theorical' call to a 'call gate' to reduce our privileges
    * and going to execute 'magically' at 'usr_main'...
@@ -0,0 +1,156 @@
+/*
+ * timer.c - Hierarchical timer wheel
+ *
+ * Adding and deleting a timer is O(1), and a clock tick only expires the
+ * timers of its slot. Timers far in the future are cascaded to a finer
+ * level once every TVR_SIZE ticks, when the first level wraps.
+ */
+
+#include <types.h>
+#include <timer.h>
+
+extern int zeos_ticks;
+
+static struct list_head tv1[TVR_SIZE];
+static struct list_head tv2[TVN_SIZE];
+static struct list_head tv3[TVN_SIZE];
+static struct list_head tv4[TVN_SIZE];
+static struct list_head tv5[TVN_SIZE];
+
+// Next tick to be processed by run_timers()
+static unsigned long timer_ticks;
+
+#define INDEX(n) ((timer_ticks >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+void init_timers(void)
+{
+  int i;
+
+  for (i = 0; i < TVR_SIZE; i++)
+    INIT_LIST_HEAD(&tv1[i]);
+  for (i = 0; i < TVN_SIZE; i++) {
+    INIT_LIST_HEAD(&tv2[i]);
+    INIT_LIST_HEAD(&tv3[i]);
+    INIT_LIST_HEAD(&tv4[i]);
+    INIT_LIST_HEAD(&tv5[i]);
+  }
+  timer_ticks = zeos_ticks + 1;
+}
+
+void init_timer(struct timer_list *timer)
+{
+  timer->entry.next = NULL;
+  timer->entry.prev = NULL;
+}
+
+int timer_pending(struct timer_list *timer)
+{
+  return timer->entry.next != NULL;
+}
+
+/* Puts 'timer' in the slot of the level that covers its expiry */
+static void internal_add_timer(struct timer_list *timer)
+{
+  unsigned long expires = timer->expires;
+  unsigned long idx = expires - timer_ticks;
+  struct list_head *vec;
+
+  if ((long)idx < 0) {
+    // Already expired: next tick
+    vec = &tv1[timer_ticks & TVR_MASK];
+  } else if (idx < TVR_SIZE) {
+    vec = &tv1[expires & TVR_MASK];
+  } else if (idx < 1UL << (TVR_BITS + TVN_BITS)) {
+    vec = &tv2[(expires >> TVR_BITS) & TVN_MASK];
+  } else if (idx < 1UL << (TVR_BITS + 2 * TVN_BITS)) {
+    vec = &tv3[(expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK];
+  } else if (idx < 1UL << (TVR_BITS + 3 * TVN_BITS)) {
+    vec = &tv4[(expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK];
+  } else {
+    vec = &tv5[(expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK];
+  }
+  list_add_tail(&timer->entry, vec);
+}
+
+/**
+ * @brief Arms 'timer' to run at tick 'timer->expires'
+ *
+ * The timer must not be pending.
+ */
+void add_timer(struct timer_list *timer)
+{
+  internal_add_timer(timer);
+}
+
+/**
+ * @brief Disarms 'timer'
+ * @return 1 if it was pending, 0 if it had already run (or was never added)
+ */
+int del_timer(struct timer_list *timer)
+{
+  if (!timer_pending(timer))
+    return 0;
+
+  list_del(&timer->entry);
+  return 1;
+}
+
+/* Redistributes the timers of tv[index] among the lower levels */
+static int cascade(struct list_head *tv, int index)
+{
+  struct list_head *head = &tv[index];
+
+  while (!list_empty(head)) {
+    struct timer_list *timer = list_entry(head->next, struct timer_list, entry);
+
+    list_del(&timer->entry);
+    internal_add_timer(timer);
+  }
+  return index;
+}
+
+/**
+ * @brief Runs the timers expired up to zeos_ticks
+ *
+ * Called from the clock interrupt. After a tickless idle period it walks
+ * all the ticks elapsed meanwhile.
+ */
+void run_timers(void)
+{
+  while ((long)(zeos_ticks - timer_ticks) >= 0) {
+    int index = timer_ticks & TVR_MASK;
+    struct list_head *head = &tv1[index];
+
+    if (!index &&
+        !cascade(tv2, INDEX(0)) &&
+        !cascade(tv3, INDEX(1)) &&
+        !cascade(tv4, INDEX(2)))
+      cascade(tv5, INDEX(3));
+
+    timer_ticks++;
+
+    while (!list_empty(head)) {
+      struct timer_list *timer = list_entry(head->next, struct timer_list, entry);
+
+      list_del(&timer->entry);
+      timer->function(timer->data);
+    }
+  }
+}
+
+/**
+ * @brief Returns the ticks from zeos_ticks until the next tick that has
+ * timers to run or to cascade, or 'max' if there is none before
+ */
+int ticks_to_next_timer(int max)
+{
+  int i;
+
+  for (i = 0; i < max; i++) {
+    unsigned long tick = timer_ticks + i;
+
+    if ((tick & TVR_MASK) == 0 || !list_empty(&tv1[tick & TVR_MASK]))
+      return tick - zeos_ticks;
+  }
+  return max;
+}
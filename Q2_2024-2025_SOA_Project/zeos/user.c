@@ -73,7 +73,7 @@ typedef enum {
 
 // ! FPS calculation
 #define TICKS_PER_SECOND 1800
-#define TICKS_PER_GAME_UPDATE 120
+#define TICKS_PER_GAME_UPDATE 667   // Clock runs at 100 ticks per second
 
 // ! Map width level sizes
 #define BASE_MAP_WIDTH 39  
@@ -175,6 +175,11 @@ int sem_init(int value);
 int sem_wait(int sem_id);
 int sem_post(int sem_id);
 int sem_destroy(int sem_id);
+int sem_post_and_yield(int sem_id);
+
+// Real-time (EDF)
+int set_deadline(int period, int budget, int deadline);
+int wait_next_period();
 
 /*------------- UTIL FUNCTIONS ------------*/
 
@@ -1104,6 +1109,762 @@ int run_semaphore_tests() {
     return 1;
 }
 
+/* ------------ BENCHMARKS ------------ */
+
+// ! Prints "<label><value>\n"
+void print_stat(char *label, int value) {
+    write(1, label, strlen(label));
+    itoa(value, buff);
+    write(1, buff, strlen(buff));
+    write(1, "\n", 1);
+}
+
+// ! Thread that keeps going through the run queue
+void *yield_thread(void *arg) {
+    for (int i = 0; i < (int)arg; ++i)
+        yield();
+    pthread_exit();
+    return NULL;
+}
+
+// Run queue operations per second with as many yielding threads as possible
+int bench_runqueue() {
+    struct sched_stats st;
+    int threads = 0;
+
+    write(1, "\nRun queue benchmark...\n", 24);
+    while (pthread_create(yield_thread, (void*)1000, 1024) >= 0)
+        ++threads;
+
+    pause(2000);  // Let the window of one second close
+
+    if (get_sched_stats(&st) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Threads: ", threads);
+    print_stat("Run queue ops/s: ", st.rq_ops_per_sec);
+    print_stat("Run queue ops: ", st.rq_ops);
+    return 1;
+}
+
+// ! CPU-bound thread: never blocks
+void *spin_thread(void *arg) {
+    int end = gettime() + (int)arg;
+    while (gettime() < end)
+        ;
+    pthread_exit();
+    return NULL;
+}
+
+// ! Interactive thread: runs a little and sleeps
+void *sleepy_thread(void *arg) {
+    for (int i = 0; i < (int)arg; ++i)
+        pause(50);
+    pthread_exit();
+    return NULL;
+}
+
+// MLFQ level changes with a CPU-bound and an interactive thread
+// (build with 'make SCHED=mlfq')
+int bench_mlfq() {
+    struct sched_stats st;
+
+    write(1, "\nMLFQ benchmark...\n", 19);
+    if (pthread_create(spin_thread, (void*)200, 1024) < 0 ||
+        pthread_create(sleepy_thread, (void*)40, 1024) < 0) {
+        perror();
+        return 0;
+    }
+
+    pause(3000);
+
+    if (get_sched_stats(&st) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Demotions: ", st.mlfq_demotions);
+    print_stat("Promotions: ", st.mlfq_promotions);
+    print_stat("Boosts: ", st.mlfq_boosts);
+    return 1;
+}
+
+// ! Worker that counts loop iterations at a given priority
+int fair_work[2];
+
+void *fair_worker(void *arg) {
+    int id = (int)arg;
+    int end = gettime() + 100;
+
+    SetPriority(id == 0 ? 10 : 40);
+    while (gettime() < end)
+        fair_work[id]++;
+    pthread_exit();
+    return NULL;
+}
+
+// CPU share of two workers with priorities 10 and 40: should be about 1:4
+// (build with 'make SCHED=fair')
+int bench_fair() {
+    write(1, "\nFair share benchmark...\n", 25);
+    if (pthread_create(fair_worker, (void*)0, 1024) < 0 ||
+        pthread_create(fair_worker, (void*)1, 1024) < 0) {
+        perror();
+        return 0;
+    }
+
+    pause(3000);
+
+    print_stat("Work at priority 10: ", fair_work[0]);
+    print_stat("Work at priority 40: ", fair_work[1]);
+    return 1;
+}
+
+// Task switches between threads of this process skip the TLB flush
+int bench_switch() {
+    struct sched_stats before, after;
+
+    write(1, "\nTask switch benchmark...\n", 26);
+    if (get_sched_stats(&before) < 0) {
+        perror();
+        return 0;
+    }
+    if (pthread_create(yield_thread, (void*)500, 1024) < 0 ||
+        pthread_create(yield_thread, (void*)500, 1024) < 0) {
+        perror();
+        return 0;
+    }
+
+    pause(2000);
+
+    if (get_sched_stats(&after) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Full switches: ", after.cs_full - before.cs_full);
+    print_stat("Same-mm switches: ", after.cs_same_mm - before.cs_same_mm);
+    print_stat("TLB flushes avoided: ",
+               after.tlb_flushes_avoided - before.tlb_flushes_avoided);
+    return 1;
+}
+
+// ! Periodic thread: runs 'arg' jobs of a few ticks every 10 ticks
+int edf_missed;
+
+void *periodic_thread(void *arg) {
+    if (set_deadline(10, 3, 10) < 0) {
+        perror();
+        pthread_exit();
+    }
+    for (int i = 0; i < (int)arg; ++i) {
+        int end = gettime() + 2;
+        while (gettime() < end)
+            ;
+        edf_missed = wait_next_period();
+    }
+    pthread_exit();
+    return NULL;
+}
+
+// A periodic EDF thread keeps its deadlines next to CPU-bound threads
+int bench_edf() {
+    struct sched_stats st;
+
+    write(1, "\nEDF benchmark...\n", 18);
+    if (pthread_create(periodic_thread, (void*)100, 1024) < 0 ||
+        pthread_create(spin_thread, (void*)1000, 1024) < 0 ||
+        pthread_create(spin_thread, (void*)1000, 1024) < 0) {
+        perror();
+        return 0;
+    }
+
+    pause(2000);
+
+    if (get_sched_stats(&st) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Deadline misses: ", edf_missed);
+    print_stat("Throttled jobs: ", st.edf_throttles);
+    print_stat("Admitted bandwidth (/1024): ", st.edf_bandwidth);
+    return 1;
+}
+
+// ! Takes the mutex 'arg' at priority 10 and keeps it for a while
+void *pi_low_thread(void *arg) {
+    int end;
+
+    SetPriority(10);
+    sem_wait((int)arg);
+    end = gettime() + 50;
+    while (gettime() < end)
+        ;
+    sem_post((int)arg);
+    pthread_exit();
+    return NULL;
+}
+
+// ! Waits for the mutex 'arg' at priority 40
+void *pi_high_thread(void *arg) {
+    SetPriority(40);
+    pause(100);
+    sem_wait((int)arg);
+    sem_post((int)arg);
+    pthread_exit();
+    return NULL;
+}
+
+// Priority inversion: a high priority thread waits for a low priority
+// holder while medium priority threads spin. The holder inherits the
+// priority of the waiter, which bounds the wait
+int bench_pi() {
+    struct sched_stats st;
+    int sem = sem_init(1);
+
+    write(1, "\nPriority inheritance benchmark...\n", 35);
+    if (sem < 0 ||
+        pthread_create(pi_low_thread, (void*)sem, 1024) < 0 ||
+        pthread_create(pi_high_thread, (void*)sem, 1024) < 0 ||
+        pthread_create(spin_thread, (void*)300, 1024) < 0) {
+        perror();
+        return 0;
+    }
+
+    pause(4000);
+
+    if (get_sched_stats(&st) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Boosts: ", st.pi_boosts);
+    print_stat("Inversions: ", st.pi_inversions);
+    print_stat("Inversion ticks: ", st.pi_inversion_ticks);
+    print_stat("Longest inversion: ", st.pi_max_inversion_ticks);
+    sem_destroy(sem);
+    return 1;
+}
+
+// ! Ping-pong between two threads through two semaphores
+int ping_sem, pong_sem, ping_handoff;
+
+void *pong_thread(void *arg) {
+    for (int i = 0; i < (int)arg; ++i) {
+        sem_wait(pong_sem);
+        if (ping_handoff)
+            sem_post_and_yield(ping_sem);
+        else
+            sem_post(ping_sem);
+    }
+    pthread_exit();
+    return NULL;
+}
+
+// Round trips of a ping-pong with sem_post and with sem_post_and_yield
+int bench_handoff() {
+    struct sched_stats st;
+    int start;
+
+    write(1, "\nHandoff benchmark...\n", 22);
+    ping_sem = sem_init(0);
+    pong_sem = sem_init(0);
+    if (ping_sem < 0 || pong_sem < 0) {
+        perror();
+        return 0;
+    }
+
+    for (ping_handoff = 0; ping_handoff < 2; ++ping_handoff) {
+        if (pthread_create(pong_thread, (void*)1000, 1024) < 0) {
+            perror();
+            return 0;
+        }
+        start = gettime();
+        for (int i = 0; i < 1000; ++i) {
+            if (ping_handoff)
+                sem_post_and_yield(pong_sem);
+            else
+                sem_post(pong_sem);
+            sem_wait(ping_sem);
+        }
+        print_stat(ping_handoff ? "1000 round trips, handoff (ticks): "
+                                : "1000 round trips, sem_post (ticks): ",
+                   gettime() - start);
+    }
+
+    if (get_sched_stats(&st) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Directed yields: ", st.directed_yields);
+    sem_destroy(pong_sem);
+    sem_destroy(ping_sem);
+    return 1;
+}
+
+fsem_t bench_fsem;
+
+// Uncontended lock/unlock: kernel semaphore against the user space one
+int bench_futex() {
+    int sem = sem_init(1);
+    int start;
+
+    write(1, "\nFutex benchmark...\n", 20);
+    if (sem < 0) {
+        perror();
+        return 0;
+    }
+    fsem_init(&bench_fsem, 1);
+
+    start = gettime();
+    for (int i = 0; i < 100000; ++i) {
+        sem_wait(sem);
+        sem_post(sem);
+    }
+    print_stat("sem_wait+sem_post x100000 (ticks): ", gettime() - start);
+
+    start = gettime();
+    for (int i = 0; i < 100000; ++i) {
+        fsem_wait(&bench_fsem);
+        fsem_post(&bench_fsem);
+    }
+    print_stat("fsem_wait+fsem_post x100000 (ticks): ", gettime() - start);
+
+    sem_destroy(sem);
+    return 1;
+}
+
+// CPU-bound threads spread over the CPUs: idle CPUs steal from busy ones
+// (run with 'make qemu NCPUS=4')
+int bench_smp() {
+    struct sched_stats before, after;
+    int threads = 0;
+
+    write(1, "\nSMP benchmark...\n", 18);
+    if (get_sched_stats(&before) < 0) {
+        perror();
+        return 0;
+    }
+    for (int i = 0; i < 8; ++i)
+        if (pthread_create(spin_thread, (void*)500, 1024) >= 0)
+            ++threads;
+
+    pause(1000);
+
+    if (get_sched_stats(&after) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("CPUs: ", after.nr_cpus);
+    print_stat("Threads: ", threads);
+    print_stat("Steals: ", after.steals - before.steals);
+    return 1;
+}
+
+// Wakeup-to-run latency of sleepy threads behind CPU-bound ones. The
+// percentiles are log2 buckets: the waits were under 2^(bucket+1) cycles
+int bench_latency() {
+    struct lat_hist h;
+
+    write(1, "\nLatency benchmark...\n", 22);
+    for (int i = 0; i < 4; ++i)
+        if (pthread_create(spin_thread, (void*)500, 1024) < 0 ||
+            pthread_create(sleepy_thread, (void*)8, 1024) < 0) {
+            perror();
+            return 0;
+        }
+
+    pause(1000);
+
+    if (get_latency(0, &h) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Wakeups: ", h.count);
+    print_stat("p50 bucket (log2 cycles): ", lat_percentile(&h, 50));
+    print_stat("p99 bucket (log2 cycles): ", lat_percentile(&h, 99));
+    print_stat("Max (cycles): ", h.max_cycles);
+    return 1;
+}
+
+// Quantum chosen by the scheduler as CPU-bound threads pile up
+int bench_quantum() {
+    struct sched_stats st;
+    struct stats ps;
+
+    write(1, "\nAdaptive quantum benchmark...\n", 31);
+    for (int i = 0; i < 6; ++i)
+        if (pthread_create(spin_thread, (void*)300, 1024) < 0) {
+            perror();
+            return 0;
+        }
+
+    pause(100);
+
+    if (get_sched_stats(&st) < 0 || get_stats(getpid(), &ps) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Switch cost (cycles): ", st.switch_cost);
+    print_stat("Slowest switch (cycles): ", st.switch_cost_max);
+    print_stat("Tick (cycles): ", st.tick_cycles);
+    print_stat("Minimum quantum: ", st.min_quantum);
+    print_stat("Quantum of this thread: ", ps.quantum);
+    return 1;
+}
+
+// Physical frames after threads come and go
+int bench_buddy() {
+    struct mem_stats before, after;
+
+    write(1, "\nFrame allocator benchmark...\n", 30);
+    if (get_mem_stats(&before) < 0) {
+        perror();
+        return 0;
+    }
+    for (int i = 0; i < 6; ++i)
+        if (pthread_create(spin_thread, (void*)(20 * i), 1024) < 0) {
+            perror();
+            return 0;
+        }
+
+    pause(150);
+
+    if (get_mem_stats(&after) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Free frames: ", after.free_frames);
+    print_stat("Largest free block (log2 frames): ", after.largest_free_order);
+    print_stat("Fragmentation (per mille): ", after.fragmentation);
+    print_stat("Splits: ", after.splits - before.splits);
+    print_stat("Merges: ", after.merges - before.merges);
+    print_stat("Failed allocations: ", after.failures);
+    return 1;
+}
+
+// Forks whose children exit right away: with copy-on-write they only copy
+// the pages they write
+int bench_fork() {
+    struct mem_stats before, after;
+    int start, pid;
+
+    write(1, "\nFork benchmark...\n", 19);
+    if (get_mem_stats(&before) < 0) {
+        perror();
+        return 0;
+    }
+    start = gettime();
+    for (int i = 0; i < 100; ++i) {
+        pid = fork();
+        if (pid == 0)
+            exit();
+        if (pid < 0) {
+            perror();
+            return 0;
+        }
+        yield();  // Let the child exit
+    }
+    print_stat("100 forks (ticks): ", gettime() - start);
+
+    if (get_mem_stats(&after) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Copy-on-write faults: ", after.cow_faults - before.cow_faults);
+    print_stat("Frames copied: ", after.cow_copies - before.cow_copies);
+    return 1;
+}
+
+// Threads with large stacks they barely use: only the pages they touch
+// get a frame
+int bench_stack() {
+    struct mem_stats before, after;
+
+    write(1, "\nThread stack benchmark...\n", 27);
+    if (get_mem_stats(&before) < 0) {
+        perror();
+        return 0;
+    }
+    for (int i = 0; i < 6; ++i)
+        if (pthread_create(spin_thread, (void*)20, 65536) < 0) {
+            perror();
+            return 0;
+        }
+
+    if (get_mem_stats(&after) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Frames for 6 stacks of 16 pages: ", before.free_frames - after.free_frames);
+    pause(50);
+
+    if (get_mem_stats(&after) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Stack pages faulted in: ", after.stack_faults - before.stack_faults);
+    return 1;
+}
+
+// Kernel object caches after some processes come and go: the semaphore
+// arrays are allocated at fork and freed at exit
+int bench_slab() {
+    struct slab_stats st;
+    int pid;
+
+    write(1, "\nKernel slab benchmark...\n", 26);
+    for (int i = 0; i < 20; ++i) {
+        pid = fork();
+        if (pid == 0)
+            exit();
+        if (pid < 0) {
+            perror();
+            return 0;
+        }
+        yield();  // Let the child exit
+    }
+
+    for (int i = 0; get_slab_stats(i, &st) == 0; ++i) {
+        if (st.allocs == 0)
+            continue;
+        write(1, st.name, strlen(st.name));
+        write(1, "\n", 1);
+        print_stat("  Objects in use: ", st.active_objs);
+        print_stat("  Slabs: ", st.slabs);
+        print_stat("  Allocations: ", st.allocs);
+        print_stat("  Slabs given back: ", st.shrinks);
+    }
+    return 1;
+}
+
+// Many more threads alive at once than the old task table had room for
+int bench_tasks() {
+    struct mem_stats before, after;
+    int n = 0;
+
+    write(1, "\nTask table benchmark...\n", 25);
+    if (get_mem_stats(&before) < 0) {
+        perror();
+        return 0;
+    }
+    while (n < 200 && pthread_create(spin_thread, (void*)100, 1024) >= 0)
+        n++;
+
+    if (get_mem_stats(&after) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Threads created: ", n);
+    print_stat("Frames used: ", before.free_frames - after.free_frames);
+
+    pause(150);
+    if (get_mem_stats(&after) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Frames not back after they exit: ", before.free_frames - after.free_frames);
+    return 1;
+}
+
+/* A child process fills a shared segment that the parent then reads in
+ * place, and shmat+shmdt is timed */
+int bench_shm() {
+    struct mem_stats before, after;
+    volatile int *shm;
+    int id, i, start;
+
+    write(1, "\nShared memory benchmark...\n", 28);
+    if (get_mem_stats(&before) < 0) {
+        perror();
+        return 0;
+    }
+    id = shmget(0, 2 * 4096);
+    if (id < 0 || (shm = shmat(id, NULL)) == (void*)-1) {
+        perror();
+        return 0;
+    }
+
+    if (fork() == 0) {
+        for (i = 2; i < 2048; i++)
+            shm[i] = i;
+        shm[0] = 100000;
+        while (--shm[0] > 0)
+            ;
+        shm[1] = 1;
+        exit();
+    }
+    while (shm[1] == 0)
+        yield();
+
+    for (i = 2; i < 2048 && shm[i] == i; i++)
+        ;
+    print_stat("Words seen from the child: ", i - 2);
+
+    start = gettime();
+    for (i = 0; i < 1000; i++) {
+        shmdt((void*)shm);
+        shm = shmat(id, NULL);
+    }
+    print_stat("shmdt+shmat x1000 (ticks): ", gettime() - start);
+
+    shmdt((void*)shm);
+    shmrm(id);
+    if (get_mem_stats(&after) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Frames not back after shmrm: ", before.free_frames - after.free_frames);
+    return 1;
+}
+
+/* Naive first-fit allocator to compare malloc with: one list of free
+ * blocks sorted by address, split on allocation and merged on free */
+struct ff_block {
+    int size;                   /* Bytes after the header */
+    struct ff_block *next;
+};
+
+static struct ff_block *ff_free;
+
+void *ff_malloc(int size) {
+    struct ff_block **pb, *b, *rest;
+
+    size = (size + 7) & ~7;
+    for (pb = &ff_free; *pb != NULL; pb = &(*pb)->next) {
+        b = *pb;
+        if (b->size < size)
+            continue;
+        if (b->size >= size + (int)sizeof(struct ff_block) + 8) {
+            rest = (struct ff_block *)((char *)(b + 1) + size);
+            rest->size = b->size - size - sizeof(struct ff_block);
+            rest->next = b->next;
+            b->size = size;
+            *pb = rest;
+        } else {
+            *pb = b->next;
+        }
+        return b + 1;
+    }
+
+    b = sbrk(sizeof(struct ff_block) + size);
+    if (b == (void*)-1)
+        return NULL;
+    b->size = size;
+    return b + 1;
+}
+
+void ff_free_block(void *p) {
+    struct ff_block *b = (struct ff_block *)p - 1, *prev = NULL, *next = ff_free;
+
+    while (next != NULL && next < b) {
+        prev = next;
+        next = next->next;
+    }
+    if (next != NULL && (char *)(b + 1) + b->size == (char *)next) {
+        b->size += sizeof(struct ff_block) + next->size;
+        next = next->next;
+    }
+    b->next = next;
+    if (prev != NULL && (char *)(prev + 1) + prev->size == (char *)b) {
+        prev->size += sizeof(struct ff_block) + b->size;
+        prev->next = b->next;
+    } else if (prev != NULL) {
+        prev->next = b;
+    } else {
+        ff_free = b;
+    }
+}
+
+#define BENCH_BLOCKS 64
+
+/* Rounds of BENCH_BLOCKS allocations of 8 to 512 bytes, freed in another
+ * order. Returns the ticks they took */
+int malloc_rounds(void *(*alloc)(int), void (*release)(void *), int rounds) {
+    void *blocks[BENCH_BLOCKS];
+    unsigned int seed = 12345;
+    int r, i, start = gettime();
+
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < BENCH_BLOCKS; i++) {
+            seed = seed * 1103515245 + 12345;
+            blocks[i] = alloc(8 + (seed >> 16) % 505);
+        }
+        for (i = 0; i < BENCH_BLOCKS; i++)
+            release(blocks[(i * 37) % BENCH_BLOCKS]);
+    }
+    return gettime() - start;
+}
+
+int bench_malloc() {
+    write(1, "\nmalloc benchmark...\n", 21);
+    print_stat("malloc/free x64000 (ticks): ", malloc_rounds(malloc, free, 1000));
+    print_stat("First fit x64000 (ticks): ", malloc_rounds(ff_malloc, ff_free_block, 1000));
+    return 1;
+}
+
+// TLB invalidations of the calls that unmap or write-protect pages: a
+// small heap shrink and shmdt use invlpg, a fork with a big heap reloads CR3
+int bench_tlb() {
+    struct mem_stats before, after;
+    char *heap;
+    int id, pid;
+
+    write(1, "\nTLB invalidation benchmark...\n", 31);
+    if (get_mem_stats(&before) < 0) {
+        perror();
+        return 0;
+    }
+
+    heap = sbrk(64 * 4096);
+    if (heap == (void*)-1) {
+        perror();
+        return 0;
+    }
+    for (int i = 0; i < 64; i++)
+        heap[i * 4096] = i;
+    pid = fork();
+    if (pid == 0)
+        exit();
+    if (pid < 0) {
+        perror();
+        return 0;
+    }
+    sbrk(-4 * 4096);
+
+    id = shmget(0, 4096);
+    if (id >= 0) {
+        shmdt(shmat(id, NULL));
+        shmrm(id);
+    }
+    sbrk(-60 * 4096);
+
+    if (get_mem_stats(&after) < 0) {
+        perror();
+        return 0;
+    }
+    print_stat("Pages invalidated with invlpg: ", after.tlb_invlpgs - before.tlb_invlpgs);
+    print_stat("Full TLB flushes: ", after.tlb_full_flushes - before.tlb_full_flushes);
+    return 1;
+}
+
+// Thread creation while the process has more and more memory areas: each
+// stack is one, so the gap search should not get slower batch after batch
+int bench_vma() {
+    int batch, n, start;
+
+    write(1, "\nMemory area benchmark...\n", 26);
+    for (batch = 0; batch < 3; batch++) {
+        start = gettime();
+        for (n = 0; n < 40; n++)
+            if (pthread_create(sleepy_thread, (void*)4, 1024) < 0) {
+                perror();
+                return 0;
+            }
+        print_stat("40 threads created (ticks): ", gettime() - start);
+    }
+    pause(400);
+    return 1;
+}
+
 /* ------------ MAIN ------------ */
 
 int __attribute__ ((__section__(".text.main")))
@@ -2,6 +2,8 @@
 #include <types.h>
 
 #include <mm_address.h>
+#include <sched.h>
+#include <vma.h>
 
 void copy_data(void *start, void *dest, int size)
 {
@@ -61,28 +63,20 @@ int copy_to_user(void *start, void *dest, int size)
  * @size:  Size of block to check
  * Returns true (nonzero) if the memory block may be valid,
  *         false (zero) if it is definitely invalid
+ * The block must lie in memory areas of the process (see vma.c) that allow
+ * the access
  */
 int access_ok(int type, const void * addr, unsigned long size)
 {
   unsigned long addr_ini, addr_fin;
 
   addr_ini=(((unsigned long)addr)>>12);
-  addr_fin=((((unsigned long)addr)+size)>>12);
+  addr_fin=((((unsigned long)addr)+(size ? size-1 : 0))>>12);
   if (addr_fin < addr_ini) return 0; //This looks like an overflow ... deny access
 
-  switch(type)
-  {
-    case VERIFY_WRITE:
-      /* Should suppose no support for automodifyable code */
-      if ((addr_ini>=USER_FIRST_PAGE+NUM_PAG_CODE)&&
-          (addr_fin<=USER_FIRST_PAGE+NUM_PAG_CODE+NUM_PAG_DATA))
-	  return 1;
-    default:
-      if ((addr_ini>=USER_FIRST_PAGE)&&
-  	(addr_fin<=(USER_FIRST_PAGE+NUM_PAG_CODE+NUM_PAG_DATA)))
-          return 1;
-  }
-  return 0;
+  /* Should suppose no support for automodifyable code */
+  return vma_access_ok(current()->master_thread, addr_ini, addr_fin,
+                       type == VERIFY_WRITE ? VM_READ | VM_WRITE : VM_READ);
 }
 
 
@@ -131,6 +125,16 @@ unsigned long get_ticks(void) {
         return ticks;
 }
 
+/* Raw TSC */
+unsigned long long get_cycles(void) {
+        unsigned long eax;
+        unsigned long edx;
+
+        rdtsc(eax,edx);
+
+        return ((unsigned long long) edx << 32) + eax;
+}
+
 void memset(void *s, unsigned char c, int size)
 {
   unsigned char *m=(unsigned char *)s;
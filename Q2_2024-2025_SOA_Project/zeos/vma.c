@@ -0,0 +1,169 @@
+/*
+ * vma.c - Memory areas of the processes
+ *
+ * Every process keeps the ranges of logical pages it uses in a list sorted
+ * by address (in its master thread): code, data, screen, heap, the stacks
+ * of its threads and its shared memory. Finding room for a new stack or
+ * segment, checking a user pointer and resolving a page fault walk the
+ * areas, not the pages nor the threads.
+ */
+
+#include <types.h>
+#include <mm.h>
+#include <sched.h>
+#include <slab.h>
+#include <vma.h>
+#include <errno.h>
+
+static struct kmem_cache *vma_cache;
+
+void init_vma(void)
+{
+  vma_cache = kmem_cache_create("vma", sizeof(struct vma), NULL);
+}
+
+/**
+ * @brief Adds the area [start, end) to the process of 'master'
+ * @return The area, or NULL if it overlaps another one or there is no
+ *         memory
+ */
+struct vma *vma_create(struct task_struct *master, unsigned int start,
+                       unsigned int end, int type, int flags)
+{
+  struct list_head *pos;
+  struct vma *vma;
+
+  // First area ending after 'start': the new one goes before it
+  list_for_each(pos, &master->vmas)
+    if (list_entry(pos, struct vma, list)->end > start)
+      break;
+  if (pos != &master->vmas && list_entry(pos, struct vma, list)->start < end)
+    return NULL;
+
+  vma = kmem_cache_alloc(vma_cache);
+  if (vma == NULL)
+    return NULL;
+
+  vma->start = start;
+  vma->end = end;
+  vma->flags = flags;
+  vma->type = type;
+  vma->guard = 0;
+  vma->private = NULL;
+  list_add_tail(&vma->list, pos);
+  return vma;
+}
+
+/* Removes 'vma' from its process. Its pages must be unmapped already */
+void vma_destroy(struct vma *vma)
+{
+  list_del(&vma->list);
+  kmem_cache_free(vma_cache, vma);
+}
+
+/* Area of the process of 'master' holding the logical page 'page', or NULL */
+struct vma *find_vma(struct task_struct *master, unsigned int page)
+{
+  struct list_head *pos;
+  struct vma *vma;
+
+  list_for_each(pos, &master->vmas) {
+    vma = list_entry(pos, struct vma, list);
+    if (page < vma->start)
+      break;
+    if (page < vma->end)
+      return vma;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Finds 'pages' free logical pages in the process of 'master'
+ * @return The first page of the lowest free range from 'from', or -1 if
+ *         there is none
+ */
+int vma_find_gap(struct task_struct *master, unsigned int from, int pages)
+{
+  struct list_head *pos;
+  struct vma *vma;
+  unsigned int start = from;
+
+  if (pages <= 0)
+    return -1;
+
+  list_for_each(pos, &master->vmas) {
+    vma = list_entry(pos, struct vma, list);
+    if (vma->end <= start)
+      continue;
+    if (vma->start >= start + pages)
+      break;
+    start = vma->end;
+  }
+  return start + pages <= TOTAL_PAGES ? start : -1;
+}
+
+/* Pages of 'vma' the process may touch: past the guard pages, and below
+ * the break in the heap */
+static void vma_usable(struct task_struct *master, struct vma *vma,
+                       unsigned int *lo, unsigned int *hi)
+{
+  *lo = vma->start + vma->guard;
+  *hi = vma->end;
+  if (vma->type == VMA_HEAP)
+    *hi = (master->heap_brk + PAGE_SIZE - 1) >> 12;
+}
+
+/* Returns 1 if the process of 'master' may access the pages 'first' to
+ * 'last' with 'flags' (VM_READ, VM_WRITE) */
+int vma_access_ok(struct task_struct *master, unsigned int first,
+                  unsigned int last, int flags)
+{
+  struct vma *vma;
+  unsigned int page = first, lo, hi;
+
+  while (page <= last) {
+    vma = find_vma(master, page);
+    if (vma == NULL || (vma->flags & flags) != flags)
+      return 0;
+    vma_usable(master, vma, &lo, &hi);
+    if (page < lo || page >= hi)
+      return 0;
+    page = hi;
+  }
+  return 1;
+}
+
+/**
+ * @brief Gives the new process 'child' the areas of the process of 'parent'
+ * it inherits: all but the stacks of the threads other than 'caller' and
+ * the shared memory (see shm_fork)
+ * @return 0, or -ENOMEM if there is no memory: the child may keep some
+ */
+int vma_fork(struct task_struct *parent, struct task_struct *child,
+             struct task_struct *caller)
+{
+  struct list_head *pos;
+  struct vma *vma, *copy;
+
+  list_for_each(pos, &parent->vmas) {
+    vma = list_entry(pos, struct vma, list);
+    if (vma->type == VMA_SHM ||
+        (vma->type == VMA_STACK && vma->private != caller))
+      continue;
+
+    copy = vma_create(child, vma->start, vma->end, vma->type, vma->flags);
+    if (copy == NULL)
+      return -ENOMEM;
+    copy->guard = vma->guard;
+    if (vma->type == VMA_STACK)
+      copy->private = child;
+  }
+  return 0;
+}
+
+/* Frees the areas of the exiting process of 'master' */
+void vma_exit(struct task_struct *master)
+{
+  while (!list_empty(&master->vmas))
+    vma_destroy(list_entry(list_first(&master->vmas), struct vma, list));
+}
@@ -12,15 +12,23 @@
  
 #define FREE_FRAME 0
 #define USED_FRAME 1
-/* Bytemap to mark the free physical pages */
+/* Bytemap to mark the free physical pages (references to the used ones) */
 extern Byte phys_mem[TOTAL_PAGES];
 
+/* Page table entry 'avail' bit: shared copy-on-write, read-only until
+ * written */
+#define PTE_COW 0x1
+
+#define CR0_WP 0x00010000
+#define CR4_PGE 0x00000080
+
 
 extern page_table_entry dir_pages[NR_TASKS][TOTAL_PAGES];
 
 int init_frames( void );
 int alloc_frame( void );
 void free_frame( unsigned int frame );
+void share_frame( unsigned int frame );
 void set_user_pages( struct task_struct *task );
 
 
@@ -39,4 +47,8 @@ void set_ss_pag(page_table_entry *PT, unsigned page,unsigned frame);
 void del_ss_pag(page_table_entry *PT, unsigned page);
 unsigned int get_frame(page_table_entry *PT, unsigned int page);
 
+void set_wp_flag();
+void share_cow_page(page_table_entry *src, page_table_entry *dst, unsigned page);
+int cow_fault(unsigned long addr);
+
 #endif  /* __MM_H__ */
@@ -16,6 +16,8 @@
 
 enum state_t { ST_RUN, ST_READY, ST_BLOCKED };
 
+struct sched_class;
+
 struct task_struct {
   int PID;			/* Process ID. This MUST be the first field of the struct. */
   page_table_entry * dir_pages_baseAddr;
@@ -27,6 +29,7 @@ struct task_struct {
   enum state_t state; /* Process state */
   int quantum; /* Remaining quantum */
   int pending_unblocks; /* Number of pending unblocks */
+  struct sched_class *sched_class; /* Scheduling policy owning the process */
 
   unsigned long kernel_esp; /* ESP saved during a context switch */
 };
@@ -62,11 +65,61 @@ page_table_entry * get_PT (struct task_struct *t) ;
 
 page_table_entry * get_DIR (struct task_struct *t) ;
 
-/* Headers for the scheduling policy */
+int get_quantum(struct task_struct *t);
+void set_quantum(struct task_struct *t, int new_quantum);
+
+/* ----------------------------------------------------------------------- */
+
+/**
+ * @brief Scheduling policy
+ *
+ * Every process points to the class that owns it while it is READY. The
+ * core scheduler (schedule(), sched_next_rr(), update_process_state_rr())
+ * only reaches the policy through these hooks:
+ * - pick_next: Removes and returns the next READY process, or NULL
+ * - enqueue:   Adds a new or preempted process to the class
+ * - dequeue:   Removes a READY process from the class
+ * - tick:      Accounts one clock tick to the running process 't'. Returns 1
+ *              if 't' must leave the CPU
+ * - wakeup:    Adds a process that was BLOCKED. Returns 1 if it should
+ *              preempt the running process
+ * Classes are asked for a process in registration order.
+ */
+struct sched_class {
+  char *name;
+  void (*init)(void);
+  struct task_struct *(*pick_next)(void);
+  void (*enqueue)(struct task_struct *t);
+  void (*dequeue)(struct task_struct *t);
+  int (*tick)(struct task_struct *t);
+  int (*wakeup)(struct task_struct *t);
+
+  int rank;       /* Registration order, set by register_sched_class() */
+  int nr_running; /* READY processes of the class, kept by the core */
+};
+
+#define MAX_SCHED_CLASSES 4
+
+/* Class of the initial process unless built with 'make SCHED=<name>' */
+#ifndef SCHED_DEFAULT
+#define SCHED_DEFAULT "rr"
+#endif
+
+extern struct sched_class *default_sched_class;
+extern int nr_ready;
+
+int register_sched_class(struct sched_class *c);
+struct sched_class *find_sched_class(char *name);
+
+/* FIFO Round Robin (sched_rr.c) */
+extern struct sched_class rr_sched_class;
+
+/* Headers for the core scheduler */
+void sched_enqueue(struct task_struct *t);
+int sched_wakeup(struct task_struct *t);
+void sched_dequeue(struct task_struct *t);
 void sched_next_rr();
 void update_process_state_rr(struct task_struct *t, struct list_head *dest);
-int needs_sched_rr();
-void update_sched_data_rr();
 
 
 /* ----------------------------------------------------------------------- */
@@ -6,6 +6,7 @@
 #include <segment.h>
 #include <hardware.h>
 #include <io.h>
+#include <mm.h>
 
 #include<stdint.h>
 
@@ -101,27 +102,43 @@ void setTrapHandler(int vector, void (*handler)(), int maxAccessibleFromPL)
   idt[vector].highOffset      = highWord((DWord)handler);
 }
 
+/* Page fault error code bits */
+#define PF_PRESENT 0x1 /* Protection violation, not a missing page */
+#define PF_WRITE   0x2
+
+static inline unsigned long read_cr2(void)
+{
+  unsigned long addr;
+
+  __asm__ __volatile__("movl %%cr2, %0" : "=r" (addr));
+  return addr;
+}
+
 /**
  * Page Fault Exception
  * 
- * Handles page fault exceptions in the system. When a page fault occurs,
- * it prints the address (EIP) where the fault happened in hexadecimal format
+ * Handles page fault exceptions in the system. A write to a copy-on-write
+ * page (from user mode, or from the kernel writing to user memory) is
+ * resolved and the faulting instruction restarts. Any other page fault
+ * prints the address (EIP) where the fault happened in hexadecimal format
  * and halts the system.
  *
  * The routine performs the following:
  * - Receives the error code and EIP (instruction pointer) where fault occurred
- * - Prints a diagnostic message with the EIP in hexadecimal format
- * - Halts the system in an infinite loop
+ * - Gives a private copy of a copy-on-write page to the writer
+ * - Otherwise, prints a diagnostic message with the EIP in hexadecimal format
+ *   and halts the system in an infinite loop
  * 
  * Parameters:
- * @param error - Error code provided by CPU (unused)
+ * @param error - Error code provided by CPU
  * @param EIP   - Program counter value when the page fault occurred (only for routine)
- *
- * @note After printing the fault address, the system enters an infinite loop.
- *       This is a fatal error handler - execution does not continue.
  */
 void _page_fault_handler(void);                                           //HANDLER
 void _page_fault_routine(unsigned long error, unsigned long EIP){         //ROUTINE
+  if ((error & (PF_PRESENT | PF_WRITE)) == (PF_PRESENT | PF_WRITE) &&
+      cow_fault(read_cr2()))
+    return;
+
   printk("\n");
   printk("Procces generates a PAGE FAULT exception at EIP: 0x");
   
@@ -312,7 +329,8 @@ void setIdt()
 
   setInterruptHandler(32, clock_handler, 0);    /* Clock */
   setInterruptHandler(33, keyboard_handler, 0); /* Keyboard */
-  setTrapHandler(14, _page_fault_handler, 0);   /* Page Fault */
+  setInterruptHandler(14, _page_fault_handler, 0); /* Page Fault (no clock
+                                                      in a copy-on-write) */
 
   // ! Configure syscall handler
 
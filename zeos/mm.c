@@ -7,6 +7,7 @@
 #include <segment.h>
 #include <hardware.h>
 #include <sched.h>
+#include <utils.h>
 
 Byte phys_mem[TOTAL_PAGES];
 
@@ -68,6 +69,8 @@ for (j=0; j< NR_TASKS; j++) {
       pagusr_table[j][i].bits.pbase_addr = i;
       pagusr_table[j][i].bits.rw = 1;
       pagusr_table[j][i].bits.present = 1;
+      // The same in every address space: kept in the TLB across CR3 writes
+      pagusr_table[j][i].bits.global = 1;
     }
 }
 }
@@ -127,6 +130,35 @@ void set_pe_flag()
   write_cr0(cr0);
 }
 
+/* Makes the read-only pages read-only for the kernel too (CR0.WP), so its
+ * writes to copy-on-write pages fault as well. Once the user code is in
+ * place */
+void set_wp_flag()
+{
+  unsigned int cr0 = read_cr0();
+  cr0 |= CR0_WP;
+  write_cr0(cr0);
+}
+
+#define read_cr4() ({ \
+         unsigned int __dummy; \
+         __asm__( \
+                 "movl %%cr4,%0\n\t" \
+                 :"=r" (__dummy)); \
+         __dummy; \
+})
+#define write_cr4(x) \
+         __asm__("movl %0,%%cr4": :"r" (x));
+
+/* Enables the global pages (CR4.PGE): a CR3 write no longer drops the
+ * kernel pages from the TLB. Once paging is enabled */
+void set_pge_flag()
+{
+  unsigned int cr4 = read_cr4();
+  cr4 |= CR4_PGE;
+  write_cr4(cr4);
+}
+
 /* Initializes paging for the system address space */
 void init_mm()
 {
@@ -136,6 +168,7 @@ void init_mm()
   allocate_DIR(&task[0].task);
   set_cr3(get_DIR(&task[0].task));
   set_pe_flag();
+  set_pge_flag();
 }
 /***********************************************/
 /************** SEGMENTATION MANAGEMENT ********/
@@ -190,7 +223,8 @@ void setTSS()
 }
 
  
-/* Initializes the ByteMap of free physical pages.
+/* Initializes the ByteMap of free physical pages (an allocated frame holds
+ * the number of page table entries mapping it).
  * The kernel pages are marked as used */
 int init_frames( void )
 {
@@ -235,11 +269,19 @@ void free_user_pages( struct task_struct *task )
 }
 
 
-/* free_frame - Mark as FREE_FRAME the frame  'frame'.*/
+/* free_frame - Drops a reference to the frame 'frame'. It is marked as
+ * FREE_FRAME with the last one.*/
 void free_frame( unsigned int frame )
 {
-    if ((frame>NUM_PAG_KERNEL)&&(frame<TOTAL_PAGES))
-      phys_mem[frame]=FREE_FRAME;
+    if ((frame>NUM_PAG_KERNEL)&&(frame<TOTAL_PAGES)&&(phys_mem[frame]!=FREE_FRAME))
+      phys_mem[frame]--;
+}
+
+/* share_frame - Adds a reference to the allocated frame 'frame'.*/
+void share_frame( unsigned int frame )
+{
+    if ((frame>NUM_PAG_KERNEL)&&(frame<TOTAL_PAGES)&&(phys_mem[frame]!=FREE_FRAME))
+      phys_mem[frame]++;
 }
 
 /* set_ss_pag - Associates logical page 'page' with physical page 'frame' */
@@ -263,3 +305,56 @@ void del_ss_pag(page_table_entry *PT, unsigned logical_page)
 unsigned int get_frame (page_table_entry *PT, unsigned int logical_page){
      return PT[logical_page].bits.pbase_addr; 
 }
+
+/***********************************************/
+/************** COPY-ON-WRITE ******************/
+/***********************************************/
+
+/* Contents of a page being unshared: the page is remapped in place */
+static Byte cow_buffer[PAGE_SIZE];
+
+/* share_cow_page - Shares logical page 'page' of 'src' with 'dst', read-only
+ * in both until one of them writes it */
+void share_cow_page(page_table_entry *src, page_table_entry *dst, unsigned page)
+{
+  src[page].bits.rw = 0;
+  src[page].bits.avail |= PTE_COW;
+  dst[page] = src[page];
+  share_frame(src[page].bits.pbase_addr);
+}
+
+/* cow_fault - Resolves a write to the read-only page at 'addr' of the
+ * current process. A copy-on-write page still shared gets a private copy of
+ * its frame; the last process mapping it just makes it writable again.
+ * Returns 1 if the write can be retried, 0 if the page is not copy-on-write
+ * or there is no free frame for the copy. */
+int cow_fault(unsigned long addr)
+{
+  page_table_entry *PT = get_PT(current());
+  unsigned int page = addr >> 12;
+  unsigned int frame;
+  int new_frame, copied = 0;
+
+  if (page >= TOTAL_PAGES || !PT[page].bits.present ||
+      !(PT[page].bits.avail & PTE_COW))
+    return 0;
+
+  frame = PT[page].bits.pbase_addr;
+  if (phys_mem[frame] > USED_FRAME) {
+    new_frame = alloc_frame();
+    if (new_frame < 0)
+      return 0;
+    copy_data((void *)(page << 12), cow_buffer, PAGE_SIZE);
+    PT[page].bits.pbase_addr = new_frame;
+    free_frame(frame);
+    copied = 1;
+  }
+
+  PT[page].bits.rw = 1;
+  PT[page].bits.avail &= ~PTE_COW;
+  set_cr3(get_DIR(current()));
+
+  if (copied)
+    copy_data(cow_buffer, (void *)(page << 12), PAGE_SIZE);
+  return 1;
+}
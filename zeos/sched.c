@@ -5,6 +5,7 @@
 #include <sched.h>
 #include <mm.h>
 #include <io.h>
+#include <errno.h>
 
 union task_union task[NR_TASKS]
   __attribute__((__section__(".data.task")));
@@ -67,7 +68,8 @@ void cpu_idle(void)
 	printk("CPU Halted\n");
 	while(1)
 	{
-	;
+		/* Sleep until the next interrupt instead of spinning */
+		__asm__ __volatile__("hlt": : :"memory");
 	}
 }	
 
@@ -101,61 +103,133 @@ void set_quantum(struct task_struct *t, int new_quantum)
 	t->quantum = new_quantum;
 }
 
+/* ----------------------------------------------------------------------- */
+
+/* Registered scheduling classes, from the highest to the lowest precedence */
+struct sched_class *sched_classes[MAX_SCHED_CLASSES];
+int nr_sched_classes = 0;
+struct sched_class *default_sched_class = NULL;
+
+int nr_ready = 0;	// Number of READY processes in all the classes
+
+static int same_name(char *a, char *b)
+{
+	while (*a && *a == *b) {
+		a++;
+		b++;
+	}
+	return *a == *b;
+}
+
 /**
- * @brief Updates the scheduling data for Round Robin policy
- * 
- * This function is called on each clock tick to update the quantum
- * counter for the current running process. The quantum represents
- * how many more clock ticks the current process can execute before
- * potentially being replaced by another process.
- * 
- * In Round Robin scheduling, each process gets a fixed time slice (quantum)
- * to execute before yielding the CPU to another process.
+ * @brief Adds a scheduling class after the already registered ones
+ *
+ * @param c Class to register. Its init hook is called here.
+ * @return 0 on success, -ENOMEM if the class table is full
  */
-void update_sched_data_rr(void)
+int register_sched_class(struct sched_class *c)
 {
-    // Decrement the remaining quantum ticks for the current process
-	queue_ticks--;
+	if (nr_sched_classes >= MAX_SCHED_CLASSES)
+		return -ENOMEM;
+
+	c->rank = nr_sched_classes;
+	c->nr_running = 0;
+	if (c->init)
+		c->init();
+
+	sched_classes[nr_sched_classes++] = c;
+	return 0;
 }
 
 /**
- * @brief Determines if a process switch is necessary
- * 
- * This function implements the core decision logic for the Round Robin
- * scheduling policy. It determines whether the current process should
- * yield the CPU to another process based on:
- * 
- * 1. Quantum expiration: The current process has used its entire time slice
- *    AND there are other processes waiting to run
- * 
- * 2. Blocked state: The current process is blocked and cannot continue
- *    executing (regardless of remaining quantum).
- *    
- * ! Remember that a blocked process (not busy waiting) NOT 
- * ! consume quantum (CPU time) and should not be considered 
- * ! for scheduling until unblocked.
- * 
- * This approach balances CPU fairness with efficiency by avoiding context
- * switches when unnecessary.
- * 
- * @return 1 if a process switch is needed, 0 otherwise
+ * @brief Returns the registered class called 'name', or NULL
  */
-int needs_sched_rr(void)
+struct sched_class *find_sched_class(char *name)
 {
-	/* If quantum expired, reset it to current process's quantum */
-	if (queue_ticks <= 0) {
-		queue_ticks = get_quantum(current());
-		
-		/* Case 1: Quantum expired AND other processes are waiting */
-		if (!list_empty(&readyqueue))
-			return 1;
-	}
-	
-	/* Case 2: Current process is blocked */
-	else if (current()->state == ST_BLOCKED)
+	int i;
+
+	for (i = 0; i < nr_sched_classes; i++)
+		if (same_name(sched_classes[i]->name, name))
+			return sched_classes[i];
+
+	return NULL;
+}
+
+/**
+ * @brief Makes a new or preempted process READY in its scheduling class
+ *
+ * @param t Process to enqueue. The idle process is never enqueued.
+ */
+void sched_enqueue(struct task_struct *t)
+{
+	if (t == idle_task)
+		return;
+
+	t->sched_class->enqueue(t);
+	t->sched_class->nr_running++;
+	nr_ready++;
+	t->state = ST_READY;
+}
+
+/**
+ * @brief Makes a process that was BLOCKED READY in its scheduling class
+ *
+ * @return 1 if 't' should preempt the running process
+ */
+int sched_wakeup(struct task_struct *t)
+{
+	struct task_struct *curr = current();
+	int preempt;
+
+	preempt = t->sched_class->wakeup(t);
+	t->sched_class->nr_running++;
+	nr_ready++;
+	t->state = ST_READY;
+
+	if (curr == idle_task || t->sched_class->rank < curr->sched_class->rank)
 		return 1;
-	
-	/* No need to schedule */
+	return preempt && t->sched_class == curr->sched_class;
+}
+
+/**
+ * @brief Removes a READY process from its scheduling class
+ */
+void sched_dequeue(struct task_struct *t)
+{
+	t->sched_class->dequeue(t);
+	t->sched_class->nr_running--;
+	nr_ready--;
+}
+
+/* Asks the classes, in order, for the next process. NULL if none is READY */
+static struct task_struct *pick_next_task(void)
+{
+	struct task_struct *t;
+	int i;
+
+	for (i = 0; i < nr_sched_classes; i++) {
+		if (sched_classes[i]->nr_running == 0)
+			continue;
+
+		t = sched_classes[i]->pick_next();
+		if (t != NULL) {
+			sched_classes[i]->nr_running--;
+			nr_ready--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Returns 1 if a class with precedence over 'c' has READY processes */
+static int higher_class_ready(struct sched_class *c)
+{
+	int i;
+
+	for (i = 0; i < c->rank; i++)
+		if (sched_classes[i]->nr_running > 0)
+			return 1;
+
 	return 0;
 }
 
@@ -169,7 +243,8 @@ int needs_sched_rr(void)
  * 
  * State transitions follow these rules:
  * - If dst_queue == NULL: Process becomes RUNNING
- * - If dst_queue == &readyqueue: Process becomes READY
+ * - If dst_queue == &readyqueue: Process becomes READY in its scheduling
+ *   class (readyqueue is only used as a token here)
  * - If dst_queue == any other queue: Process becomes BLOCKED
  * 
  * @param t Process whose state is being updated
@@ -177,112 +252,80 @@ int needs_sched_rr(void)
  */
 void update_process_state_rr(struct task_struct *t, struct list_head *dst_queue)
 {
-    struct list_head *t_list = &t->list;
-
-	// Only remove from current queue if not running
-	// (running processes aren't in any queue)
-	if (t->state != ST_RUN) {
-		// printk("Updating process state\n");
-		// Remove from current queue
-		list_del(t_list);
+	enum state_t prev = t->state;
+
+	// Running processes aren't in any queue
+	if (prev == ST_READY)
+		sched_dequeue(t);
+	else if (prev != ST_RUN)
+		list_del(&t->list);
+
+	// Handle destination queue and state update
+	if (dst_queue == NULL) {
+		// No destination queue = running state
+		t->state = ST_RUN;
+	} else if (dst_queue == &readyqueue) {
+		if (prev == ST_BLOCKED)
+			sched_wakeup(t);
+		else
+			sched_enqueue(t);
+	} else {
+		list_add_tail(&t->list, dst_queue);
+		t->state = ST_BLOCKED;
 	}
-    
-    // Handle destination queue and state update
-    if (dst_queue != NULL) {
-        // Add to destination queue
-        list_add_tail(t_list, dst_queue);
-        
-        // Update state based on destination queue
-        if (dst_queue == &readyqueue) {
-            t->state = ST_READY;
-        } else {
-            t->state = ST_BLOCKED;
-        }
-    } else {
-        // No destination queue = running state
-        t->state = ST_RUN;
-    }
 }
 
 /**
  * @brief Selects and switches to the next process to run
  * 
- * This function implements the process selection logic for Round Robin
- * scheduling. It:
- * 
- * 1. Selects the next process from the ready queue if available
- * 2. Falls back to the idle process if no ready processes exist
- * 3. Resets the quantum counter for the selected process
- * 4. Performs the actual context switch to the new process
- * 
- * This ensures that CPU time is allocated fairly among ready processes,
- * with the idle process only running when no other work is available.
+ * The scheduling classes are asked in order for their next READY process.
+ * Falls back to the idle process if no ready processes exist, resets the
+ * quantum counter for the selected process and performs the actual
+ * context switch.
  */
 void sched_next_rr(void)
 {
-    struct list_head *next;
-    struct task_struct *next_task;
-
-    // Select next process: from ready queue if possible, idle process otherwise
-    if (!list_empty(&readyqueue)) {
-		// ? Debugging messages
-		// printk("Scheduling next process\n");
-        
-		// Get the first process from the ready queue (FIFO order)
-        next = list_first(&readyqueue);
-		// list_del(next);
-		// Get the task_struct pointer from the list_head pointer
-        next_task = list_head_to_task_struct(next);
-		// Remove from the ready queue 
-		update_process_state_rr(next_task, NULL);
-		 
-    } else {
-		// ? Debugging messages
-		// printk("No ready processes, scheduling idle task\n");
-        
-		// Fall back to idle task if no processes are ready
-        next_task = idle_task;
-    }
-    // Reset quantum counter for the next process
-    queue_ticks = next_task->quantum;
-
-    // Perform the actual context switch
-    task_switch((union task_union*)next_task);
+	struct task_struct *next_task;
+
+	// Fall back to idle task if no processes are ready
+	next_task = pick_next_task();
+	if (next_task == NULL)
+		next_task = idle_task;
+
+	next_task->state = ST_RUN;
+
+	// Reset quantum counter for the next process
+	queue_ticks = next_task->quantum;
+
+	// Perform the actual context switch
+	task_switch((union task_union*)next_task);
 }
 
 /**
  * @brief Main scheduling function that coordinates the process switching
  * 
- * This function is the central coordinator of the scheduling subsystem.
- * It is called periodically from the timer interrupt handler and:
- * 
- * 1. Updates scheduling data (quantum counter)
- * 2. Determines if a process switch is needed
- * 3. If needed:
- *    a. Moves current process to ready queue
- *    b. Selects and switches to next process
- * 
- * This implementation follows a preemptive Round Robin approach,
- * ensuring fair CPU allocation while maintaining system responsiveness.
+ * This function is called periodically from the timer interrupt handler.
+ * The tick hook of the class of the current process decides if it has to
+ * leave the CPU; it also does when a class with precedence has READY
+ * processes. The idle process leaves the CPU as soon as anything is READY.
  */
 void schedule(void)
 {
-    // Update quantum counter
-    update_sched_data_rr();
-    
-    // Check if we need to perform a context switch
-    if (needs_sched_rr()) {
-        // Move current process to ready queue
-		struct task_struct *current_pcb = (struct task_struct*)current();
-        update_process_state_rr(current_pcb, &readyqueue);
-        // Select and switch to next process
-        sched_next_rr();
-
-		// ? Debugging messages
-		// printk("\nNew process scheduled with PID: ");
-		// print_number(current()->PID);
-		// printk("\n");
-    }
+	struct task_struct *current_pcb = current();
+	int resched;
+
+	if (current_pcb == idle_task)
+		resched = nr_ready > 0;
+	else
+		resched = current_pcb->sched_class->tick(current_pcb) ||
+			  higher_class_ready(current_pcb->sched_class);
+
+	if (resched) {
+		// Move current process to ready queue
+		update_process_state_rr(current_pcb, &readyqueue);
+		// Select and switch to next process
+		sched_next_rr();
+	}
 }
 
 /**
@@ -332,6 +375,7 @@ void init_idle (void)
 	set_quantum(idle_pcb, DEFAULT_QUANTUM);
 	idle_pcb->pending_unblocks = 0;
 	idle_pcb->state = ST_READY;	// ! Mark as ready
+	idle_pcb->sched_class = default_sched_class;
 	// idle_pcb->parent = idle_pcb;	// ! Parent is himself
 	
 	// Initialize the kids
@@ -399,6 +443,7 @@ void init_task1(void)
 	set_quantum(task1_pcb, DEFAULT_QUANTUM);
 	task1_pcb->pending_unblocks = 0;
 	task1_pcb->state = ST_RUN;	// ! Mark as running
+	task1_pcb->sched_class = default_sched_class;	// Inherited by its children
 	// task1_pcb->parent = task1_pcb;	// ! Parent is himself 
 	
 	// Initialize the kids 
@@ -435,11 +480,10 @@ void init_task1(void)
 void init_sched()
 {
 	/**
-	 * 1. Initialize the freequeue and the readyqueue 
+	 * 1. Initialize the freequeue and the blocked queue
 	 *    as empty lists. 
 	 **/
   	INIT_LIST_HEAD(&freequeue);
-  	INIT_LIST_HEAD(&readyqueue);
 	INIT_LIST_HEAD(&blocked);
 
 	/* 2. Add all the tasks to the freequeue */
@@ -451,6 +495,15 @@ void init_sched()
 
 	// Initialize quantum counter for the first execution
 	queue_ticks = DEFAULT_QUANTUM;
+
+	/* 3. Register the scheduling classes and select the default one */
+	register_sched_class(&rr_sched_class);
+
+	default_sched_class = find_sched_class(SCHED_DEFAULT);
+	if (default_sched_class == NULL) {
+		printk("Unknown scheduling class, using rr\n");
+		default_sched_class = &rr_sched_class;
+	}
 }
 
 
@@ -0,0 +1,73 @@
+/*
+ * sched_rr.c - Round Robin scheduling class: READY processes wait in a FIFO
+ * queue and run for a whole quantum
+ */
+
+#include <sched.h>
+
+extern struct list_head readyqueue;
+extern int queue_ticks;
+
+static void rr_init(void)
+{
+	INIT_LIST_HEAD(&readyqueue);
+}
+
+static void rr_enqueue(struct task_struct *t)
+{
+	list_add_tail(&t->list, &readyqueue);
+}
+
+static void rr_dequeue(struct task_struct *t)
+{
+	list_del(&t->list);
+}
+
+/* Removes and returns the first process of the ready queue (FIFO order) */
+static struct task_struct *rr_pick_next(void)
+{
+	struct task_struct *t;
+
+	if (list_empty(&readyqueue))
+		return NULL;
+
+	t = list_head_to_task_struct(list_first(&readyqueue));
+	list_del(&t->list);
+	return t;
+}
+
+/**
+ * @brief Decrements the remaining quantum of the running process
+ *
+ * ! A blocked process does not consume quantum: it is not running
+ *
+ * @return 1 if the quantum expired AND other processes are waiting
+ */
+static int rr_tick(struct task_struct *t)
+{
+	queue_ticks--;
+
+	/* If quantum expired, reset it to current process's quantum */
+	if (queue_ticks <= 0) {
+		queue_ticks = get_quantum(t);
+		return nr_ready > 0;
+	}
+	return 0;
+}
+
+/* A woken up process waits for its turn like any other */
+static int rr_wakeup(struct task_struct *t)
+{
+	rr_enqueue(t);
+	return 0;
+}
+
+struct sched_class rr_sched_class = {
+	.name      = "rr",
+	.init      = rr_init,
+	.pick_next = rr_pick_next,
+	.enqueue   = rr_enqueue,
+	.dequeue   = rr_dequeue,
+	.tick      = rr_tick,
+	.wakeup    = rr_wakeup,
+};
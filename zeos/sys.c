@@ -57,37 +57,8 @@ int ret_from_fork(){
  */
 int init_child_address_space(struct task_struct *child_pcb)
 {
-
-  int new_frames[NUM_PAG_DATA];   /* No shared frames */
-  int SHARED_SPACE, TOTAL_SPACE;
-
   /**
-   * 4. Search frames (physical pages) in which to map 
-   * logical pages for data+stack of the child process. 
-   * If there are not enough free pages, an error will be returned.
-   * 
-   */
-  for (int frame = 0; frame < NUM_PAG_DATA; frame++)
-  {
-    // Search for a free frame
-    new_frames[frame] = alloc_frame();
-    
-    // Check if there's enough free frames
-    if (new_frames[frame] < 0)
-    {
-      // Free frames of previous process that was allocated before to avoid memory leaks
-      for (int frameD = 0; frameD < frame; frameD++)
-      {
-        free_frame(new_frames[frameD]); 
-      }
-      // Enqueue again the child process in the freequeue
-      list_add_tail(&child_pcb->list, &freequeue);
-      return -EAGAIN; /*Try Again*/
-    }
-  }
-
-  /**
-   * 5 .Initialize child’s address space: 
+   * 4. Initialize child's address space: 
    * Modify the page table of the child process to map 
    * the logical addresses to the physical ones. 
    * This page table is accessible through the directory
@@ -96,26 +67,9 @@ int init_child_address_space(struct task_struct *child_pcb)
   page_table_entry *child_PT = get_PT(child_pcb);  /* User Entries */
   page_table_entry *parent_PT = get_PT(current()); /* System Entries (can be shared)*/
 
-  /**
-   * 6. Inherit user data
-   * Copy the user data+stack pages from the parent process to the child process. 
-   * The child’s physical pages are not accessible because 
-   * they are not mapped in the parent’s page table. 
-   * 
-   * Therefore they must be temporarily mapped in some available space in
-   * the parent so both regions (from parent and child) 
-   * can be accessed simultaneously and copied.
-   */
-  SHARED_SPACE = NUM_PAG_KERNEL + NUM_PAG_CODE;
-  TOTAL_SPACE = SHARED_SPACE + NUM_PAG_DATA;  
-
   // SYSTEM CODE (KERNEL)
-  // Parent and child point to the same physical page in the kernel space (shared)
-  for (int frame = 0; frame < NUM_PAG_KERNEL; frame++)
-  {
-    set_ss_pag(child_PT, frame + 0, get_frame(parent_PT, frame + 0));
-    // child_PT[frame] = parent_PT[frame]
-  }
+  // Already mapped: init_table_pages fills the kernel pages of every page
+  // table at boot, as global pages
 
   // USER CODE
   // Code pages are read-only and shared between parent and child and don't need to be copied
@@ -126,40 +80,19 @@ int init_child_address_space(struct task_struct *child_pcb)
     // child_PT[PAG_LOG_INIT_CODE + frame] = parent_PT[PAG_LOG_INIT_CODE + frame]
   }
 
-  // DATA + STACK
-  // Map logical pages of the child process to the physical pages allocated 
-  for (int frame = 0; frame < NUM_PAG_DATA; frame++)
-  {
-    set_ss_pag(child_PT, PAG_LOG_INIT_DATA + frame, new_frames[frame]);
-    // child_PT[PAG_LOG_INIT_DATA + frame] = parent_PT[PAG_LOG_INIT_DATA + frame]
-  }
-  
   /**
-   * !IMPORTANT!
-   * ! Parent process cannot access to physical pages of the child process directly
-   * Grant temporary access to parent process (data+stack space of the child)
-   * Parent point data+stack space (@F) of the child to make a copy.
+   * 5. Inherit user data
+   * DATA + STACK pages are shared copy-on-write: both processes map the
+   * parent's frames read-only, and the first one to write a page gets its
+   * own copy of it (see cow_fault in mm.c). Nothing is copied here.
    */
-   for (int frame = 0; frame < NUM_PAG_DATA; frame++)
+  for (int frame = 0; frame < NUM_PAG_DATA; frame++)
   {
-    // Below data+stack space.
-    // Map the shared space to the parent to access the child's physical frames
-    set_ss_pag(parent_PT, TOTAL_SPACE + frame, new_frames[frame]); 
-
-    /**
-     * Do << 12 shift because of the page size [4KB - 12 bits] [PAGE_SIZE = 0x1000 = 4096]
-     * in order to get the page address. Is the same by doing * PAGESIZE.
-     */
-    copy_data((void *)((PAG_LOG_INIT_DATA + frame) << 12), // Origin : Parent Data 
-              (void *)((TOTAL_SPACE + frame) << 12),       // Destination : "Child" Data 
-              PAGE_SIZE);                                  // Size : PAGE_SIZE (4KB)
-    // parent_PT[TOTAL_SPACE + frame] = child_PT[PAG_LOG_INIT_DATA + frame]
-
-    // Unmap the shared space to avoid the child to access the parent's data
-    del_ss_pag(parent_PT, TOTAL_SPACE + frame);  
+    share_cow_page(parent_PT, child_PT, PAG_LOG_INIT_DATA + frame);
+    // child_PT[PAG_LOG_INIT_DATA + frame] = parent_PT[PAG_LOG_INIT_DATA + frame] (read-only)
   }
 
-  // TLB flush (invalidate TLB entries with the shared pages)
+  // TLB flush (the parent's data+stack pages are read-only now)
   set_cr3(get_DIR(current()));
 
   return 0;
@@ -270,8 +203,8 @@ int sys_fork()
   // esp points to fake ebp (it will pop and on top of the stack will be the ret from fork)
   child_union->task.kernel_esp = (unsigned long) &(child_union->stack[KERNEL_STACK_SIZE - 19]);
 
-  // 10. Enqueue the child process in the readyqueue to be executed 
-  list_add_tail(&child_pcb->list, &readyqueue);
+  // 10. Enqueue the child process in the ready queue of its scheduling class
+  sched_enqueue(child_pcb);
 
   return PID;
 }
@@ -369,8 +302,7 @@ void sys_block(void)
   {
     current_pcb->state = ST_BLOCKED;  // Change the state to blocked
     list_add_tail(&current_pcb->list, &blocked); // Add to the blocked queue
-    schedule(); // Select a new process to run
-    // sched_next_rr(); // Select a new process to run
+    sched_next_rr(); // Select a new process to run
   }
   else
   {
@@ -409,10 +341,9 @@ int sys_unblock(int PID)
       // If the process is blocked, unblock it
       if (unblocked_pcb->state == ST_BLOCKED)
       {
-        unblocked_pcb->state = ST_READY;  // Change the state to ready
         // unblocked_pcb->pending_unblocks = 0; // Reset pending unblocks
         list_del(unblocked_list); // Remove from the blocked queue
-        list_add_tail(unblocked_list, &readyqueue); // Add to the ready queue
+        sched_wakeup(unblocked_pcb); // Add to the ready queue
         return 0;
       }
       // If the process is not blocked, return an error
@@ -97,6 +97,9 @@ int __attribute__((__section__(".text.main")))
   /* Move user code/data now (after the page table initialization) */
   copy_data((void *) KERNEL_START + *p_sys_size, (void*)L_USER_START, *p_usr_size);
 
+  /* From now on the kernel cannot write to read-only user pages either */
+  set_wp_flag();
+
 
   printk("Entering user mode...");
 